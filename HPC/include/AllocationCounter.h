@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+using namespace std;
+
+#ifndef HPC_COUNT_ALLOCATIONS
+#   ifdef NDEBUG
+#       define HPC_COUNT_ALLOCATIONS false // Counts heap allocations made by the frame loop (debug builds)
+#   else
+#       define HPC_COUNT_ALLOCATIONS true
+#   endif
+#endif
+
+/**
+ * Debug count of the heap allocations made by the threads running the frame loop, so a step
+ * that allocates can be caught. When HPC_COUNT_ALLOCATIONS is set the global operator new is
+ * replaced to count the allocations of tracked threads, otherwise the count is always 0.
+ */
+class AllocationCounter
+{
+public:
+
+	/** Counts the allocations of the calling thread from now on. */
+	static void trackThread();
+
+	/**
+	* Gets the number of allocations made by tracked threads so far.
+	* @return The count.
+	*/
+	static uint64_t count();
+
+	/** Stops counting the calling thread's allocations for a scope, for work allowed to allocate. */
+	class Pause
+	{
+	public:
+
+		/** Constructor. */
+		Pause();
+
+		/** Destructor. */
+		~Pause();
+
+		Pause(const Pause&) = delete;
+		Pause& operator=(const Pause&) = delete;
+
+	private:
+
+		bool m_tracked; /**< Whether the thread was tracked on entry */
+	};
+};
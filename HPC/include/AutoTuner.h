@@ -0,0 +1,140 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+
+using namespace std;
+
+/**
+ * Tunes how per ball work is split between threads while the simulation runs. Every so often the
+ * step time of the current settings is measured, a neighbouring setting is tried for a few steps
+ * and kept if it was faster. The best settings are kept per range of ball counts (powers of two)
+ * and can be saved to a cache file, keyed by host, so the next run starts from them.
+ */
+class AutoTuner
+{
+public:
+
+	struct Settings
+	{
+		uint32_t m_chunksPerThread; /**< Standard chunks made for each thread */
+		uint32_t m_grain;           /**< Smallest number of balls claimed at once by the dynamic/guided schedules */
+		uint32_t m_threads;         /**< Most threads (including the caller) a pass runs on */
+
+		bool operator==(const Settings& other) const = default;
+	};
+
+	/**
+	* Constructor.
+	* @param defaults   The settings used for ball counts with nothing tuned.
+	* @param maxThreads The pool's workers plus the calling thread.
+	* @param enabled    False to always use the defaults.
+	*/
+	AutoTuner(const Settings& defaults, uint32_t maxThreads, bool enabled);
+
+	/**
+	* Picks the settings for a step, switching to the best known for its ball count.
+	* @param balls The number of balls in the step.
+	* @return True if the settings changed.
+	*/
+	bool select(uint32_t balls);
+
+	/**
+	* Adds the time of a completed step, starting or finishing a trial if needed.
+	* @param stepTime The step time in milliseconds.
+	* @return True if the settings changed.
+	*/
+	bool update(double stepTime);
+
+	/**
+	* Throws away the current measurement, for when something other than the settings changed
+	* the step time.
+	*/
+	void restart();
+
+	/**
+	* Gets the settings to use.
+	* @return The settings.
+	*/
+	const Settings& getSettings() const;
+
+	/**
+	* Reads the settings tuned on this host by an earlier run.
+	* @param fileName The cache file.
+	* @return The number of ball count ranges read.
+	*/
+	uint32_t load(const string& fileName);
+
+	/**
+	* Writes the settings tuned on this host, keeping those of other hosts.
+	* @param fileName The cache file.
+	* @return True if successful.
+	*/
+	bool save(const string& fileName) const;
+
+	/**
+	* Checks if a trial has found better settings since the tuner was created, so there is something
+	* new to save.
+	* @return True if the best settings changed.
+	*/
+	bool hasImproved() const;
+
+	/**
+	* Gets where a cache file is kept. Relative names are placed next to the executable rather than
+	* in the working directory, which depends on how the program was started.
+	* @param fileName The cache file name.
+	* @return The path to read and write.
+	*/
+	static string cachePath(const string& fileName);
+
+private:
+
+	/** Steps run on the best settings between trials */
+	static const uint32_t s_intervalSteps = 120;
+	/** Steps timed for the best settings and for a trial */
+	static const uint32_t s_windowSteps = 16;
+	/** Steps not timed after the settings change while caches warm up */
+	static const uint32_t s_settleSteps = 2;
+	/** Fraction a trial must be faster by to be kept, so noise does not wander the settings */
+	static constexpr double s_margin = 0.03;
+
+	/** What the step times are being collected for. */
+	enum class Phase
+	{
+		Waiting,  /**< Running the best settings until the next trial */
+		Baseline, /**< Timing the best settings */
+		Trial     /**< Timing a neighbouring setting */
+	};
+
+	struct Entry
+	{
+		Settings m_settings; /**< The best settings found */
+		double m_time;       /**< Mean step time of the best settings in milliseconds */
+	};
+
+	/**
+	* Gets the next setting to try, one parameter moved one step from the best.
+	* @return The setting.
+	*/
+	Settings nextTrial();
+
+	/**
+	* Gets the name the cache file stores this host's settings under.
+	* @return The host name and number of logical processors.
+	*/
+	static string hostKey();
+
+	Settings m_defaults;             /**< Settings for ball counts with nothing tuned */
+	uint32_t m_maxThreads;           /**< Most threads a pass can run on */
+	bool m_enabled;                  /**< Whether trials are run */
+	map<uint32_t, Entry> m_best;     /**< Best settings of each ball count range */
+	uint32_t m_range = UINT32_MAX;   /**< Ball count range of the current step */
+	Settings m_settings;             /**< Settings in use */
+	Phase m_phase = Phase::Waiting;  /**< What the step times are collected for */
+	uint32_t m_steps = 0;            /**< Steps counted in the current phase */
+	uint32_t m_skip = 0;             /**< Steps still to skip before timing */
+	double m_total = 0.0;            /**< Sum of the step times counted */
+	double m_baseline = 0.0;         /**< Mean step time of the best settings before the trial */
+	uint32_t m_candidate = 0;        /**< Index of the next neighbour to try */
+	bool m_improved = false;         /**< Whether a trial has been kept */
+};
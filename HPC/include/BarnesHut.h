@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Vector3_SSE.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+/**
+ * Octree used to approximate long range (gravity like) attraction between all balls in
+ * O(N log N). Each ball has a mass of twice its radius to match the contact model.
+ */
+class BarnesHut
+{
+public:
+
+	/**
+	* Constructor.
+	* @param pool The thread pool used to build and evaluate the tree.
+	*/
+	explicit BarnesHut(ThreadPool& pool);
+
+	/**
+	* Sets the opening angle. Cells smaller than theta times their distance are treated as a
+	* single point mass, 0 gives the exact all pairs result.
+	* @param theta The opening angle.
+	*/
+	void setOpeningAngle(float theta);
+
+	/**
+	* Gets the opening angle.
+	* @return The opening angle.
+	*/
+	float getOpeningAngle() const;
+
+	/**
+	* Sets the strength of the attraction.
+	* @param strength The gravitational constant.
+	*/
+	void setStrength(float strength);
+
+	/**
+	* Adds a fixed point that attracts every ball.
+	* @param position The position of the attractor.
+	* @param mass     The mass of the attractor.
+	*/
+	void addAttractor(const Vector3& position, float mass);
+
+	/** Removes all attractors. */
+	void clearAttractors();
+
+	/**
+	* Builds the tree over a set of balls.
+	* @param positions The ball positions (radius stored in the 4th element).
+	* @param count     The number of balls.
+	*/
+	void build(const Vector3* positions, uint32_t count);
+
+	/**
+	* Computes the long range acceleration of a range of balls using the last built tree.
+	* @param positions     The ball positions the tree was built from.
+	* @param start         The first ball.
+	* @param end           One past the last ball.
+	* @param accelerations Output acceleration of each ball.
+	*/
+	void accelerate(const Vector3* positions, uint32_t start, uint32_t end, Vector3* accelerations) const;
+
+	/**
+	* Gets the number of nodes in the last built tree.
+	* @return Number of nodes.
+	*/
+	size_t nodeCount() const;
+
+private:
+
+	struct Node
+	{
+		Vector3 m_mass;     /**< Centre of mass with the total mass in the 4th element */
+		float m_size;       /**< Edge length of the cell */
+		uint32_t m_first;   /**< First child node, or first entry of m_order for a leaf */
+		uint32_t m_count;   /**< Number of child nodes, or number of balls for a leaf */
+		bool m_leaf;        /**< True if the node holds balls rather than child nodes */
+	};
+
+	/** Number of cells along each axis built as independent subtrees */
+	static const uint32_t s_gridSize = 4;
+	/** Number of balls at which a cell stops being subdivided */
+	static const uint32_t s_leafSize = 8;
+
+	ThreadPool& m_pool;               /**< The pool the build and evaluation run on */
+	float m_theta = 0.5f;             /**< The opening angle */
+	float m_strength = 0.05f;         /**< The gravitational constant */
+	float m_softening = 1.0f;         /**< Squared distance added to avoid singular forces */
+	vector<Vector3> m_attractors;     /**< Fixed attractors, mass in the 4th element */
+	vector<uint32_t> m_order;         /**< Ball indices sorted by cell */
+	vector<uint32_t> m_cellOf;        /**< Top level grid cell of each ball */
+	vector<vector<uint32_t>> m_counts;/**< Per chunk histogram of the top level cells */
+	vector<vector<Node>> m_cellNodes; /**< Independently built subtree of each top level cell */
+	vector<Node> m_nodes;             /**< The combined tree, the root is node 0 */
+	const Vector3* m_positions = nullptr; /**< Positions the tree was built from */
+
+	void buildNode(vector<Node>& nodes, uint32_t slot, uint32_t begin, uint32_t end, const Vector3& centre,
+		float size, uint32_t depth);
+	static Node combine(const vector<Node>& nodes, uint32_t first, uint32_t count, float size);
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/**
+ * Headless micro benchmarks for the simulation building blocks. Built into the program when
+ * HPC_BENCHMARK is defined, in which case they are run instead of the engine and the results
+ * are written to the program log.
+ */
+class Benchmark
+{
+public:
+
+	/**
+	* Runs every benchmark.
+	* @return True if every benchmark produced a valid result.
+	*/
+	static bool run();
+
+private:
+
+	/**
+	* Times building and evaluating the Barnes-Hut tree against the ball count and checks its
+	* error against the exact all pairs sum.
+	* @return True if the approximation was within tolerance.
+	*/
+	static bool barnesHut();
+
+	/**
+	* Times dispatching an empty frame of chunks to the pool through futures, through a latch
+	* and through parallel_for.
+	* @return True if every chunk was run exactly once.
+	*/
+	static bool dispatch();
+
+	/**
+	* Times a frame of chunks run as coroutines awaited with when_all against the same frame
+	* submitted with a latch.
+	* @return True if every chunk was run exactly once.
+	*/
+	static bool coroutines();
+
+	/**
+	* Times parallel_reduce, parallel_scan, parallel_radix_sort and parallel_partition on pools of
+	* 1 thread up to one per cpu, on arrays of balls and separate arrays of keys, and checks each
+	* against the serial standard library result.
+	* @return True if every result matched.
+	*/
+	static bool algorithms();
+
+	/**
+	* Times passing items from 1 to 64 producer threads to a consumer per cpu through the pool's
+	* lock free queue and eventcount, and through a mutex protected queue and condition variable.
+	* @return True if every item was received exactly once.
+	*/
+	static bool queue();
+
+	/**
+	* Times the same contact counting workload on pools using each affinity policy, with and
+	* without a reserved core for the calling thread.
+	* @return True if every policy produced the same result.
+	*/
+	static bool affinity();
+
+	/**
+	* Writes a line of benchmark output.
+	* @param line The line to write (without the end line).
+	*/
+	static void report(const string& line);
+};
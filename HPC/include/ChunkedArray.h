@@ -0,0 +1,186 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "NumaStorage.h"
+
+using namespace std;
+
+/**
+ * Per ball array stored in fixed size blocks that never move. Growing the array adds blocks
+ * instead of reallocating, so spawning balls never copies the existing ones and pointers to them
+ * stay valid. Every array of the same type splits its balls into blocks at the same indices, so a
+ * range inside one block is contiguous in all of them and the pair loops walk those spans. The
+ * blocks come from a NumaStorage, which keeps them contiguous in an arena slot while they fit.
+ */
+template<class T>
+class ChunkedArray
+{
+	static_assert(is_trivially_destructible_v<T>, "blocks are freed without destroying the items");
+
+public:
+
+	/** Log2 of the number of items in a block */
+	static const uint32_t s_blockShift = 12;
+	/** Number of items in a block, a multiple of NumaStorage::s_blockBalls */
+	static const uint32_t s_blockItems = 1u << s_blockShift;
+
+	/**
+	* Constructor.
+	* @param storage The storage the blocks are allocated from.
+	*/
+	explicit ChunkedArray(NumaStorage* storage)
+		: m_storage(storage)
+	{
+	}
+
+	/** Destructor. */
+	~ChunkedArray()
+	{
+		clear();
+		shrink_to_fit();
+	}
+
+	ChunkedArray(const ChunkedArray&) = delete;
+	ChunkedArray& operator=(const ChunkedArray&) = delete;
+
+	ChunkedArray(ChunkedArray&& other) noexcept
+		: m_storage(other.m_storage)
+	{
+		swap(other);
+	}
+
+	ChunkedArray& operator=(ChunkedArray&& other) noexcept
+	{
+		swap(other);
+		return *this;
+	}
+
+	T& operator[](const size_t index)
+	{
+		return m_blocks[index >> s_blockShift][index & (s_blockItems - 1)];
+	}
+
+	const T& operator[](const size_t index) const
+	{
+		return m_blocks[index >> s_blockShift][index & (s_blockItems - 1)];
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+	/**
+	* Gets the number of items the allocated blocks hold.
+	* @return The capacity.
+	*/
+	size_t capacity() const
+	{
+		return m_blocks.size() << s_blockShift;
+	}
+
+	void push_back(const T& value)
+	{
+		if (m_size == capacity()) {
+			addBlock();
+		}
+		(*this)[m_size++] = value;
+	}
+
+	/**
+	* Resizes the array, value initialising any new items.
+	* @param size The new size.
+	*/
+	void resize(const size_t size)
+	{
+		reserve(size);
+		for (size_t index = m_size; index < size; index++) {
+			(*this)[index] = T();
+		}
+		m_size = size;
+	}
+
+	void reserve(const size_t size)
+	{
+		while (capacity() < size) {
+			addBlock();
+		}
+	}
+
+	void clear()
+	{
+		m_size = 0;
+	}
+
+	/** Frees the blocks past the last item, and the arena slot once there are none. */
+	void shrink_to_fit()
+	{
+		const size_t used = (m_size + s_blockItems - 1) >> s_blockShift;
+		while (m_blocks.size() > used) {
+			m_storage->freeBlock(m_slot, m_blocks.back(), s_blockItems * sizeof(T));
+			m_blocks.pop_back();
+		}
+		if (m_blocks.empty()) {
+			m_storage->releaseSlot(m_slot);
+		}
+		m_blocks.shrink_to_fit();
+	}
+
+	/**
+	* Gets the blocks, each holding s_blockItems items (the last up to size()).
+	* @return Pointer to the start of each block.
+	*/
+	const T* const* blocks() const
+	{
+		return m_blocks.data();
+	}
+
+	/**
+	* Calls a function for each part of a range that lies in one block.
+	* @param begin The first item.
+	* @param end   One past the last item.
+	* @param func  Called with the first and one past the last item of the span and a pointer to
+	*              the first item.
+	*/
+	template<class F>
+	void forEachSpan(const uint32_t begin, const uint32_t end, F&& func) const
+	{
+		uint32_t first = begin;
+		while (first < end) {
+			const uint32_t last = min(end, ((first >> s_blockShift) + 1) << s_blockShift);
+			func(first, last, &(*this)[first]);
+			first = last;
+		}
+	}
+
+	void swap(ChunkedArray& other) noexcept
+	{
+		std::swap(m_storage, other.m_storage);
+		std::swap(m_slot, other.m_slot);
+		std::swap(m_size, other.m_size);
+		m_blocks.swap(other.m_blocks);
+	}
+
+private:
+
+	/** Allocates the next block. */
+	void addBlock()
+	{
+		m_blocks.push_back(static_cast<T*>(m_storage->allocateBlock(m_slot, capacity(), s_blockItems * sizeof(T),
+			sizeof(T))));
+	}
+
+	NumaStorage* m_storage;     /**< Storage the blocks come from */
+	void* m_slot = nullptr;     /**< Arena slot the blocks are placed in while they fit */
+	vector<T*> m_blocks;        /**< The blocks in order */
+	size_t m_size = 0;          /**< Number of items */
+};
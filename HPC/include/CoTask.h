@@ -0,0 +1,408 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Latch.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+template<class T = void>
+class CoTask;
+
+/** The parts of a CoTask promise shared by every result type. */
+class CoPromiseBase
+{
+public:
+
+	/** Completing a task resumes the coroutine awaiting it on the same thread. */
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		template<class Promise>
+		coroutine_handle<> await_suspend(coroutine_handle<Promise> handle) noexcept
+		{
+			coroutine_handle<> continuation = handle.promise().m_continuation;
+			return continuation ? continuation : noop_coroutine();
+		}
+
+		void await_resume() const noexcept
+		{
+		}
+	};
+
+	suspend_always initial_suspend() const noexcept
+	{
+		return {};
+	}
+
+	FinalAwaiter final_suspend() const noexcept
+	{
+		return {};
+	}
+
+	void unhandled_exception() noexcept
+	{
+		m_exception = current_exception();
+	}
+
+	coroutine_handle<> m_continuation;  /**< The coroutine awaiting the task */
+	exception_ptr m_exception;          /**< The exception the task ended with */
+};
+
+/** Promise of a CoTask with a result. */
+template<class T>
+class CoPromise : public CoPromiseBase
+{
+public:
+
+	CoTask<T> get_return_object() noexcept;
+
+	template<class U>
+	void return_value(U&& value)
+	{
+		m_value.emplace(forward<U>(value));
+	}
+
+	/**
+	* Gets the result of the completed task.
+	* @return The result, rethrowing the exception the task ended with.
+	*/
+	T& result()
+	{
+		if (m_exception) {
+			rethrow_exception(m_exception);
+		}
+		return *m_value;
+	}
+
+	optional<T> m_value;  /**< The result */
+};
+
+/** Promise of a CoTask without a result. */
+template<>
+class CoPromise<void> : public CoPromiseBase
+{
+public:
+
+	CoTask<void> get_return_object() noexcept;
+
+	void return_void() const noexcept
+	{
+	}
+
+	/** Rethrows the exception the completed task ended with, if any. */
+	void result()
+	{
+		if (m_exception) {
+			rethrow_exception(m_exception);
+		}
+	}
+};
+
+/**
+ * A lazily started coroutine. The task runs when it is awaited, on the awaiting thread, until it
+ * suspends itself (for example with co_await schedule_on(pool)). Once complete the awaiting
+ * coroutine is resumed by the thread that completed it, so no thread blocks while waiting.
+ */
+template<class T>
+class CoTask
+{
+public:
+
+	using promise_type = CoPromise<T>;
+	using handle_type = coroutine_handle<promise_type>;
+
+	/** Awaits the task, starting it on the awaiting thread. */
+	template<bool Move>
+	struct Awaiter
+	{
+		bool await_ready() const noexcept
+		{
+			return m_handle.done();
+		}
+
+		coroutine_handle<> await_suspend(coroutine_handle<> awaiting) noexcept
+		{
+			m_handle.promise().m_continuation = awaiting;
+			return m_handle;
+		}
+
+		decltype(auto) await_resume()
+		{
+			if constexpr (is_void_v<T>) {
+				m_handle.promise().result();
+			} else if constexpr (Move) {
+				//moved out by value as an awaited temporary task is destroyed with its result
+				return T(move(m_handle.promise().result()));
+			} else {
+				return static_cast<T&>(m_handle.promise().result());
+			}
+		}
+
+		handle_type m_handle;  /**< The awaited task */
+	};
+
+	/** Awaits the completion of the task without taking its result or exception. */
+	struct ReadyAwaiter : Awaiter<false>
+	{
+		void await_resume() const noexcept
+		{
+		}
+	};
+
+	/**
+	* Constructor.
+	* @param handle The coroutine.
+	*/
+	explicit CoTask(handle_type handle) noexcept
+		: m_handle(handle)
+	{
+	}
+
+	CoTask(CoTask&& other) noexcept
+		: m_handle(exchange(other.m_handle, nullptr))
+	{
+	}
+
+	CoTask& operator=(CoTask&& other) noexcept
+	{
+		if (this != &other) {
+			destroy();
+			m_handle = exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+
+	CoTask(const CoTask& other) = delete;
+
+	CoTask& operator=(const CoTask& other) = delete;
+
+	/** Destructor, the task must have completed or never started. */
+	~CoTask()
+	{
+		destroy();
+	}
+
+	Awaiter<false> operator co_await() & noexcept
+	{
+		return Awaiter<false>{ m_handle };
+	}
+
+	Awaiter<true> operator co_await() && noexcept
+	{
+		return Awaiter<true>{ m_handle };
+	}
+
+	/**
+	* Awaits the task without taking its result, which is then read by awaiting it again.
+	* @return The awaiter.
+	*/
+	ReadyAwaiter ready() noexcept
+	{
+		return ReadyAwaiter{ { m_handle } };
+	}
+
+	/**
+	* Gets the result of the completed task, rethrowing the exception it ended with.
+	* @return The result.
+	*/
+	decltype(auto) get()
+	{
+		return Awaiter<true>{ m_handle }.await_resume();
+	}
+
+	/**
+	* Checks if the task has completed.
+	* @return True if complete.
+	*/
+	bool done() const noexcept
+	{
+		return m_handle.done();
+	}
+
+private:
+
+	void destroy() noexcept
+	{
+		if (m_handle) {
+			m_handle.destroy();
+			m_handle = nullptr;
+		}
+	}
+
+	handle_type m_handle;  /**< The coroutine */
+};
+
+template<class T>
+CoTask<T> CoPromise<T>::get_return_object() noexcept
+{
+	return CoTask<T>(CoTask<T>::handle_type::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object() noexcept
+{
+	return CoTask<void>(CoTask<void>::handle_type::from_promise(*this));
+}
+
+/** A coroutine that starts at once and frees itself on completion, nothing can await it. */
+struct CoDetached
+{
+	struct promise_type
+	{
+		CoDetached get_return_object() const noexcept
+		{
+			return {};
+		}
+
+		suspend_never initial_suspend() const noexcept
+		{
+			return {};
+		}
+
+		suspend_never final_suspend() const noexcept
+		{
+			return {};
+		}
+
+		void return_void() const noexcept
+		{
+		}
+
+		void unhandled_exception() const noexcept
+		{
+			terminate();
+		}
+	};
+};
+
+/** Resumes the awaiting coroutine as a job on a thread pool. */
+struct ScheduleAwaiter
+{
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(coroutine_handle<> awaiting)
+	{
+		m_pool.enqueueFunc([awaiting]() {
+			awaiting.resume();
+		});
+	}
+
+	void await_resume() const noexcept
+	{
+	}
+
+	ThreadPool& m_pool;  /**< The pool to resume on */
+};
+
+/**
+* Moves the awaiting coroutine onto a worker of a pool.
+* @param pool The pool.
+* @return The awaiter.
+*/
+inline ScheduleAwaiter schedule_on(ThreadPool& pool)
+{
+	return ScheduleAwaiter{ pool };
+}
+
+/** Runs a set of tasks on a pool and resumes the awaiting coroutine once the last completes. */
+template<class T>
+struct WhenAllAwaiter
+{
+	bool await_ready() const noexcept
+	{
+		return m_tasks.empty();
+	}
+
+	bool await_suspend(coroutine_handle<> awaiting)
+	{
+		m_continuation = awaiting;
+		//Count one extra for this thread so the last task cannot resume the awaiting
+		// coroutine while tasks are still being started
+		m_remaining.store(static_cast<uint32_t>(m_tasks.size()) + 1, memory_order_relaxed);
+		for (auto& task : m_tasks) {
+			start(task);
+		}
+		return m_remaining.fetch_sub(1, memory_order_acq_rel) != 1;
+	}
+
+	void await_resume() const noexcept
+	{
+	}
+
+	CoDetached start(CoTask<T>& task)
+	{
+		if (m_schedule) {
+			co_await schedule_on(m_pool);
+		}
+		co_await task.ready();
+		//The worker completing the last task resumes the awaiting coroutine
+		if (m_remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+			m_continuation.resume();
+		}
+	}
+
+	ThreadPool& m_pool;              /**< The pool the tasks start on */
+	vector<CoTask<T>>& m_tasks;      /**< The tasks */
+	bool m_schedule = true;          /**< False to start the tasks on the awaiting thread */
+	atomic<uint32_t> m_remaining = 0;/**< Tasks still running plus one while starting */
+	coroutine_handle<> m_continuation = {};/**< The awaiting coroutine */
+};
+
+/**
+* Runs a set of tasks concurrently on a pool. Each task is started on a worker, a task that moves
+* itself with co_await schedule_on(pool) would then hop twice, so such tasks are started on the
+* awaiting thread instead by passing schedule as false.
+* @param pool     The pool.
+* @param tasks    The tasks.
+* @param schedule False if the tasks move themselves onto the pool.
+* @return A task completing with every result, in the order of the tasks, once all have completed.
+*/
+template<class T>
+CoTask<conditional_t<is_void_v<T>, void, vector<T>>> when_all(ThreadPool& pool, vector<CoTask<T>> tasks,
+	bool schedule = true)
+{
+	co_await WhenAllAwaiter<T>{ pool, tasks, schedule };
+	if constexpr (is_void_v<T>) {
+		for (auto& task : tasks) {
+			co_await task;
+		}
+	} else {
+		vector<T> results;
+		results.reserve(tasks.size());
+		for (auto& task : tasks) {
+			results.push_back(co_await move(task));
+		}
+		co_return results;
+	}
+}
+
+/**
+* Runs a task and waits for it from outside a coroutine. A worker calling this runs other jobs
+* while it waits rather than sleeping.
+* @param pool The pool the task runs on.
+* @param task The task.
+* @return The result of the task.
+*/
+template<class T>
+T sync_wait(ThreadPool& pool, CoTask<T> task)
+{
+	Latch latch(1);
+	[](CoTask<T>& task, Latch& latch) -> CoDetached {
+		co_await task.ready();
+		latch.countDown();
+	}(task, latch);
+	pool.wait(latch);
+	return task.get();
+}
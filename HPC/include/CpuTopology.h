@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The logical processors of the host and the physical core and package (socket) each belongs
+ * to. Read from /sys/devices/system/cpu on Linux and GetLogicalProcessorInformationEx on
+ * Windows, anything else is treated as one package of single threaded cores.
+ */
+class CpuTopology
+{
+public:
+
+	struct Cpu
+	{
+		uint32_t m_id;      /**< The logical processor number used for pinning */
+		uint32_t m_core;    /**< Physical core, shared between SMT siblings (unique across packages) */
+		uint32_t m_package; /**< The package (socket) */
+	};
+
+	/** The orders threads can be placed across the logical processors. */
+	enum class Affinity
+	{
+		None,          /**< No pinning, the OS places threads */
+		Compact,       /**< Fill every SMT sibling of a core, then every core of a package, first */
+		Scatter,       /**< Spread across packages then cores, SMT siblings are used last */
+		PhysicalCores  /**< One thread per physical core, spread as for Scatter */
+	};
+
+	/**
+	* Reads the topology of the host.
+	* @return The topology.
+	*/
+	static CpuTopology detect();
+
+	/**
+	* Gets the logical processors.
+	* @return The processors sorted by id.
+	*/
+	const vector<Cpu>& cpus() const;
+
+	/**
+	* Gets the number of physical cores.
+	* @return Number of cores.
+	*/
+	uint32_t coreCount() const;
+
+	/**
+	* Gets the number of packages.
+	* @return Number of packages.
+	*/
+	uint32_t packageCount() const;
+
+	/**
+	* Gets the logical processors in the order an affinity policy hands them to threads.
+	* @param affinity    The placement policy.
+	* @param excludeCore A physical core to leave out (UINT32_MAX for none).
+	* @return The processors in placement order (empty for Affinity::None).
+	*/
+	vector<Cpu> order(Affinity affinity, uint32_t excludeCore = UINT32_MAX) const;
+
+	/**
+	* Pins a thread to a single logical processor.
+	* @param handle The native handle of the thread.
+	* @param cpu    The logical processor.
+	* @return True if successful.
+	*/
+	static bool pin(thread::native_handle_type handle, uint32_t cpu);
+
+	/**
+	* Restricts a thread to a set of logical processors, the OS places it among them.
+	* @param handle The native handle of the thread.
+	* @param cpus   The logical processors (on Windows only those in the group of the first).
+	* @return True if successful.
+	*/
+	static bool pin(thread::native_handle_type handle, const vector<uint32_t>& cpus);
+
+	/**
+	* Pins the calling thread to a single logical processor.
+	* @param cpu The logical processor.
+	* @return True if successful.
+	*/
+	static bool pinCurrentThread(uint32_t cpu);
+
+	/**
+	* Allows the calling thread to run on any cpu of the process again.
+	* @return True if successful.
+	*/
+	static bool unpinCurrentThread();
+
+	/**
+	* Gets the logical processor the calling thread is running on now.
+	* @return The processor, 0 if it cannot be found.
+	*/
+	static uint32_t currentCpu();
+
+private:
+
+	vector<Cpu> m_cpus;   /**< The logical processors sorted by id */
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * Lets threads sleep until a condition they poll without locks may have changed. A waiter calls
+ * prepareWait(), rechecks its condition and then either wait() or cancelWait(). A notifier changes
+ * the condition and then calls notify, which costs one load when nobody is waiting. Sleeping is
+ * done with atomic wait (a futex on Linux, WaitOnAddress on Windows), so sleepers use no cpu.
+ */
+class EventCount
+{
+public:
+
+	/**
+	* Registers the calling thread as about to wait. The waiters condition must be rechecked after
+	* this call and before wait().
+	* @return The key passed to wait().
+	*/
+	uint32_t prepareWait()
+	{
+		m_waiters.fetch_add(1, memory_order_seq_cst);
+		//order the registration before the condition is rechecked, pairs with the fence in notify
+		atomic_thread_fence(memory_order_seq_cst);
+		return m_epoch.load(memory_order_acquire);
+	}
+
+	/** Unregisters a waiter whose condition became true after prepareWait(). */
+	void cancelWait()
+	{
+		m_waiters.fetch_sub(1, memory_order_relaxed);
+	}
+
+	/**
+	* Sleeps until notified, returning at once if a notify has happened since prepareWait().
+	* @param key The key returned by prepareWait().
+	*/
+	void wait(uint32_t key)
+	{
+		while (m_epoch.load(memory_order_acquire) == key) {
+			m_epoch.wait(key, memory_order_acquire);
+		}
+		m_waiters.fetch_sub(1, memory_order_relaxed);
+	}
+
+	/** Wakes one waiting thread, if any. Called after the condition has changed. */
+	void notifyOne()
+	{
+		if (hasWaiters()) {
+			m_epoch.fetch_add(1, memory_order_release);
+			m_epoch.notify_one();
+		}
+	}
+
+	/** Wakes every waiting thread. Called after the condition has changed. */
+	void notifyAll()
+	{
+		if (hasWaiters()) {
+			m_epoch.fetch_add(1, memory_order_release);
+			m_epoch.notify_all();
+		}
+	}
+
+private:
+
+	/**
+	* Checks for registered waiters after the condition change is visible to them.
+	* @return True if any thread is waiting or about to.
+	*/
+	bool hasWaiters()
+	{
+		atomic_thread_fence(memory_order_seq_cst);
+		return m_waiters.load(memory_order_relaxed) != 0;
+	}
+
+	alignas(64) atomic<uint32_t> m_epoch = 0; /**< Incremented by each notify that finds waiters */
+	atomic<uint32_t> m_waiters = 0;           /**< Threads between prepareWait() and the end of wait() */
+};
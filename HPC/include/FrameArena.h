@@ -0,0 +1,180 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Bump allocator for temporaries that all die together, either once per frame (reset()) or at
+ * the end of a scope (Scope). Allocating is one compare and swap on the offset so any thread may
+ * allocate, individual allocations are never freed. When the buffer runs out the rest of the
+ * allocations fall back to the heap and the buffer is regrown to the peak use the next time the
+ * arena is emptied, so a steady workload stops touching the heap after its first frames.
+ */
+class FrameArena
+{
+public:
+
+	/** Default size of the buffer */
+	static const size_t s_defaultBytes = 64 * 1024;
+
+	/** Rewinds an arena to where it was when the scope was entered. */
+	class Scope
+	{
+	public:
+
+		/**
+		* Constructor.
+		* @param arena The arena.
+		*/
+		explicit Scope(FrameArena& arena)
+			: m_arena(arena)
+			, m_mark(arena.mark())
+		{
+		}
+
+		/** Destructor. */
+		~Scope()
+		{
+			m_arena.rewind(m_mark);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+
+		FrameArena& m_arena; /**< The arena */
+		size_t m_mark;       /**< Offset of the arena on entry */
+	};
+
+	/**
+	* Constructor.
+	* @param bytes The initial size of the buffer.
+	*/
+	explicit FrameArena(size_t bytes = s_defaultBytes);
+
+	/** Destructor. */
+	~FrameArena();
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	/**
+	* Allocates memory valid until the arena is rewound past it.
+	* @param bytes     The size.
+	* @param alignment The alignment (at most 64).
+	* @return The memory.
+	*/
+	void* allocate(size_t bytes, size_t alignment = alignof(max_align_t));
+
+	/**
+	* Allocates an uninitialised array.
+	* @param count The number of elements.
+	* @return The array.
+	*/
+	template<class T>
+	T* allocate(const size_t count)
+	{
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	/**
+	* Gets the current offset, to rewind to later.
+	* @return The offset.
+	*/
+	size_t mark() const;
+
+	/**
+	* Frees everything allocated since mark() returned the offset. Only called when no other thread
+	* is allocating.
+	* @param mark The offset.
+	*/
+	void rewind(size_t mark);
+
+	/** Frees everything, once per frame. Only called when no other thread is allocating. */
+	void reset();
+
+	/**
+	* Gets the size of the buffer.
+	* @return The size in bytes.
+	*/
+	size_t getCapacity() const;
+
+	/**
+	* Gets the most memory in use at once.
+	* @return The size in bytes.
+	*/
+	size_t getPeak() const;
+
+private:
+
+	/** Alignment of the buffer and of heap fallbacks */
+	static constexpr size_t s_alignment = 64;
+
+	/**
+	* Allocates from the heap once the buffer is full.
+	* @param bytes The size.
+	* @return The memory.
+	*/
+	void* allocateOverflow(size_t bytes);
+
+	char* m_buffer = nullptr;      /**< The buffer */
+	size_t m_capacity = 0;         /**< Size of the buffer */
+	atomic<size_t> m_offset = 0;   /**< Offset of the next allocation */
+	size_t m_peak = 0;             /**< Most bytes in use at once */
+	mutex m_overflowMutex;         /**< Guards the heap fallbacks */
+	vector<void*> m_overflow;      /**< Heap fallbacks freed when the arena is emptied */
+	size_t m_overflowBytes = 0;    /**< Size of the heap fallbacks */
+};
+
+/**
+ * Allocator placing a container in a FrameArena, so temporary vectors cost no heap allocation.
+ * Freed memory is only reclaimed when the arena is rewound.
+ */
+template<class T>
+class ArenaAllocator
+{
+public:
+
+	using value_type = T;
+
+	/**
+	* Constructor.
+	* @param arena The arena allocated from.
+	*/
+	explicit ArenaAllocator(FrameArena& arena) noexcept
+		: m_arena(&arena)
+	{
+	}
+
+	template<class U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+		: m_arena(other.m_arena)
+	{
+	}
+
+	T* allocate(const size_t count)
+	{
+		return m_arena->allocate<T>(count);
+	}
+
+	void deallocate(T*, size_t) noexcept
+	{
+	}
+
+	template<class U>
+	bool operator==(const ArenaAllocator<U>& other) const noexcept
+	{
+		return m_arena == other.m_arena;
+	}
+
+	FrameArena* m_arena; /**< The arena allocated from */
+};
+
+/** A vector of temporaries held in a FrameArena. */
+template<class T>
+using ArenaVector = vector<T, ArenaAllocator<T>>;
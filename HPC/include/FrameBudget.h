@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Keeps simulation steps within a time budget by trading away quality. The smoothed step time is
+ * compared against a target, while it stays over the target the next enabled degradation is
+ * applied, while it stays well under the target the last one applied is removed again. Every
+ * change is written to the program log. Degradations are applied in the order they are declared.
+ */
+class FrameBudget
+{
+public:
+
+	/** The ways quality can be reduced, as flags. */
+	enum Degradation : uint32_t
+	{
+		SkipSleeping = 1,  /**< Balls at rest are only updated every few steps */
+		CoarseSteps = 2,   /**< Fewer, longer steps and fewer solver iterations */
+		ReducedRender = 4  /**< The scene is rendered at half rate */
+	};
+
+	/**
+	* Constructor.
+	* @param target       The step time budget in milliseconds (0 disables the controller).
+	* @param degradations The Degradation flags that may be applied.
+	*/
+	FrameBudget(float target, uint32_t degradations);
+
+	/**
+	* Adds the time of a completed step, applying or removing a degradation if needed. Degradations
+	* that do nothing in the current configuration are passed over and never reported as active.
+	* @param stepTime   The step time in milliseconds.
+	* @param applicable The Degradation flags that have an effect in the current configuration.
+	* @return True if the active degradations changed.
+	*/
+	bool update(double stepTime, uint32_t applicable);
+
+	/**
+	* Checks if a degradation is applied. May be called from any thread.
+	* @param degradation The degradation.
+	* @return True if it is applied.
+	*/
+	bool isActive(Degradation degradation) const;
+
+	/**
+	* Gets the number of degradations applied.
+	* @return The level (0 for full quality).
+	*/
+	uint32_t getLevel() const;
+
+	/**
+	* Gets the step time budget.
+	* @return The budget in milliseconds.
+	*/
+	float getTarget() const;
+
+private:
+
+	/** Weight of each new step in the smoothed step time */
+	static constexpr double s_smoothing = 0.1;
+	/** Consecutive steps over the budget before quality is reduced */
+	static const uint32_t s_overSteps = 8;
+	/** Consecutive steps under the headroom before quality is restored */
+	static const uint32_t s_underSteps = 120;
+	/** Fraction of the budget steps must stay under before quality is restored */
+	static constexpr double s_headroom = 0.6;
+
+	/**
+	* Changes the number of degradations applied and logs the change.
+	* @param level      The new level.
+	* @param changed    Index of the degradation applied or removed.
+	* @param applicable The Degradation flags that have an effect in the current configuration.
+	*/
+	void setLevel(uint32_t level, uint32_t changed, uint32_t applicable);
+
+	float m_target;                  /**< The step time budget in milliseconds */
+	vector<Degradation> m_levels;    /**< The enabled degradations in the order they are applied */
+	atomic<uint32_t> m_level = 0;    /**< Number of degradations applied */
+	atomic<uint32_t> m_active = 0;   /**< Flags of the degradations applied */
+	double m_average = 0.0;          /**< Smoothed step time in milliseconds */
+	uint32_t m_over = 0;             /**< Consecutive steps with the smoothed time over the budget */
+	uint32_t m_under = 0;            /**< Consecutive steps with the smoothed time under the headroom */
+};
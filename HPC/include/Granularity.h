@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include "ThreadPool.h"
+
+using namespace std;
+
+/**
+ * Chooses how many threads a pass over the balls is worth spreading across. Calibrated once at
+ * startup by timing the pool's dispatch overhead and the cost of the per ball work, a pass is then
+ * run inline when splitting it would cost more than it saves, on only some of the threads when it
+ * only has enough work for a few, or on every thread.
+ */
+class Granularity
+{
+public:
+
+	/**
+	* Times the dispatch overhead of a pool and the cost of a ball pair test and a ball update.
+	* @param pool The pool the passes are run on.
+	*/
+	void calibrate(ThreadPool& pool);
+
+	/**
+	* Gets the number of threads (including the caller) a pass should run on.
+	* @param items    The number of items in the pass.
+	* @param itemCost The estimated cost of an item in nanoseconds.
+	* @return The number of threads, 1 to run the pass inline.
+	*/
+	uint32_t participants(uint32_t items, double itemCost) const;
+
+	/**
+	* Limits the number of threads any pass runs on.
+	* @param limit The most threads (including the caller).
+	*/
+	void setThreadLimit(uint32_t limit);
+
+	/**
+	* Gets the most threads a pass can run on.
+	* @return The pool's workers plus the calling thread.
+	*/
+	uint32_t getMaxParticipants() const;
+
+	/**
+	* Gets the cost of testing one pair of balls for contact.
+	* @return The cost in nanoseconds.
+	*/
+	double getPairCost() const;
+
+	/**
+	* Gets the cost of integrating one ball.
+	* @return The cost in nanoseconds.
+	*/
+	double getUpdateCost() const;
+
+	/**
+	* Gets the cost of starting and finishing a parallel_for on every thread.
+	* @return The cost in nanoseconds.
+	*/
+	double getDispatchCost() const;
+
+private:
+
+	/** Work each thread must be given, in multiples of the dispatch cost, before it is used */
+	static constexpr double s_workPerThread = 2.0;
+
+	uint32_t m_maxParticipants = UINT32_MAX; /**< The pool's workers plus the caller */
+	uint32_t m_threadLimit = UINT32_MAX;     /**< Most threads a pass may use */
+	double m_dispatchCost = 0.0;   /**< Nanoseconds to run an empty parallel_for on every thread */
+	double m_pairCost = 1.0;       /**< Nanoseconds to test a pair of balls */
+	double m_updateCost = 1.0;     /**< Nanoseconds to integrate a ball */
+};
@@ -18,7 +18,98 @@
 #include <vector>
 #include "Vector3_SSE.h"
 #include "ThreadPool.h"
+#include "BarnesHut.h"
+#include "TaskGraph.h"
+#include "FrameBudget.h"
+#include "Granularity.h"
+#include "AutoTuner.h"
+#include "NumaStorage.h"
+#include "ChunkedArray.h"
+#include "FrameArena.h"
+#include "AllocationCounter.h"
+#include "ParallelAlgorithms.h"
 using namespace std;
+#ifndef HPC_USE_XPBD
+#   define HPC_USE_XPBD false
+#endif
+#ifndef HPC_XPBD_ITERATIONS
+#   define HPC_XPBD_ITERATIONS 8
+#endif
+#ifndef HPC_TWO_PASS
+#   define HPC_TWO_PASS false
+#endif
+#ifndef HPC_LONG_RANGE
+#   define HPC_LONG_RANGE false
+#endif
+#ifndef HPC_OPENING_ANGLE
+#   define HPC_OPENING_ANGLE 0.5f
+#endif
+#ifndef HPC_LONG_RANGE_STRENGTH
+#   define HPC_LONG_RANGE_STRENGTH 0.05f
+#endif
+#ifndef HPC_USE_CCD
+#   define HPC_USE_CCD true
+#endif
+#ifndef HPC_CCD_FRACTION
+#   define HPC_CCD_FRACTION 0.5f    // Fraction of the smallest radius a ball may move before it is swept
+#endif
+#ifndef HPC_SCHEDULE
+#   define HPC_SCHEDULE Guided      // How per ball work is shared between threads (Static, Dynamic, Guided or CostModel)
+#endif
+#ifndef HPC_SCHEDULE_GRAIN
+#   define HPC_SCHEDULE_GRAIN 32    // Smallest number of balls claimed at once by the dynamic/guided schedules
+#endif
+#ifndef HPC_AUTO_TUNE
+#   define HPC_AUTO_TUNE true       // Try nearby chunk counts, grains and thread counts while running and keep the fastest
+#endif
+#ifndef HPC_TUNING_CACHE
+#   define HPC_TUNING_CACHE "tuning.cache" // File the tuned settings of each host are kept in, relative to the executable (empty for none)
+#endif
+#ifndef HPC_NUMA_STORAGE
+#   define HPC_NUMA_STORAGE false   // Ball arrays are first touched by, and always updated on, the threads owning each block
+#endif
+#ifndef HPC_ARENA_BALLS
+#   define HPC_ARENA_BALLS (1 << 20) // Balls the huge page arena holds before new ball blocks are allocated outside it (0 for no arena)
+#endif
+#ifndef HPC_ARENA_PREFAULT
+#   define HPC_ARENA_PREFAULT (1 << 16) // Balls of the arena faulted in at startup (all of them with HPC_NUMA_STORAGE)
+#endif
+#ifndef HPC_THREADS
+#   define HPC_THREADS 0            // Number of worker threads (0 for one per cpu allowed by HPC_AFFINITY)
+#endif
+#ifndef HPC_AFFINITY
+#   define HPC_AFFINITY None        // Worker placement (None, Compact, Scatter or PhysicalCores)
+#endif
+#ifndef HPC_RESERVE_RENDER_CORE
+#   define HPC_RESERVE_RENDER_CORE false // Keep a physical core for the thread running HPCEngine::run
+#endif
+#ifndef HPC_BACKGROUND_THREADS
+#   define HPC_BACKGROUND_THREADS 0 // Most workers running background work at once (0 for half of them)
+#endif
+#ifndef HPC_STAGE_TIMINGS
+#   define HPC_STAGE_TIMINGS ""     // File the frame stage timings are written to on unload (empty for none)
+#endif
+#ifndef HPC_FRAME_BUDGET
+#   define HPC_FRAME_BUDGET 16.7f   // Step time in milliseconds quality is reduced to stay within (0 to disable)
+#endif
+#ifndef HPC_BUDGET_LEVELS
+#   define HPC_BUDGET_LEVELS 7      // FrameBudget::Degradation flags that may be applied (1 sleeping, 2 coarse steps, 4 render rate)
+#endif
+#ifndef HPC_SLEEP_SPEED
+#   define HPC_SLEEP_SPEED 0.05f    // Speed below which a ball counts as at rest
+#endif
+#ifndef HPC_CONTACT_COST
+#   define HPC_CONTACT_COST 4       // Cost of resolving a contact relative to testing one pair of balls
+#endif
+#ifndef HPC_MAX_BALLS
+#   define HPC_MAX_BALLS 0          // Live balls kept, the oldest are removed to make room for new ones (0 for no limit)
+#endif
+#ifndef HPC_ESCAPE_DISTANCE
+#   define HPC_ESCAPE_DISTANCE 0.0f // Distance from the centre along any axis past which a ball has left the box and is removed (0 to keep them)
+#endif
+#ifndef HPC_COMPACT_SHARE
+#   define HPC_COMPACT_SHARE 8      // Live balls are packed together once 1 in this many slots is removed
+#endif
 
 
 class HPCAssignment
@@ -73,18 +164,434 @@ public:
     /** Unloads any data created during load() */
     void unload() noexcept;
 
+    /** The available simulation engines. */
+    enum class Solver
+    {
+        Force,  /**< Spring/damper contact forces (doSomeBallStuff) */
+        XPBD    /**< Extended position based dynamics contact constraints */
+    };
+
+    /**
+     * Selects the simulation engine used by subsequent calls to run().
+     * @param solver The solver to use.
+     */
+    void setSolver(Solver solver) noexcept;
+
+    /**
+     * Gets the currently selected simulation engine.
+     * @return The solver.
+     */
+    Solver getSolver() const noexcept;
+
+    /** The ways the force solver can advance the balls. */
+    enum class Integration
+    {
+        DoubleBuffered, /**< Write new positions/velocities into a second copy and swap */
+        TwoPass         /**< Write a force array then integrate positions/velocities in place */
+    };
+
+    /**
+     * Selects how the force solver integrates the balls.
+     * @note The XPBD solver always uses the double buffers.
+     * @param integration The integration mode to use.
+     */
+    void setIntegration(Integration integration) noexcept;
+
+    /**
+     * Gets the current integration mode.
+     * @return The integration mode.
+     */
+    Integration getIntegration() const noexcept;
+
+    /**
+     * Enables or disables the Barnes-Hut long range attraction between balls (and attractors).
+     * @param enabled True to add the long range term.
+     */
+    void setLongRange(bool enabled) noexcept;
+
+    /**
+     * Gets if the long range attraction is enabled.
+     * @return True if enabled.
+     */
+    bool getLongRange() const noexcept;
+
+    /**
+     * Adds a fixed attractor to the long range term.
+     * @param x    The x position.
+     * @param y    The y position.
+     * @param z    The z position.
+     * @param mass The mass of the attractor.
+     */
+    void addAttractor(float x, float y, float z, float mass);
+
+    /** The ways per ball work is shared between the threads. */
+    enum class Schedule
+    {
+        Static,  /**< Fixed equal sized chunks (2 per thread until tuned) */
+        Dynamic, /**< Threads claim HPC_SCHEDULE_GRAIN balls (until tuned) at a time until none are left */
+        Guided,  /**< Threads claim a share of the remaining balls, shrinking towards the end */
+        CostModel/**< Contact passes are split into equal cost ranges using the previous step's contacts */
+    };
+
+    /**
+     * Selects how per ball work is shared between the threads.
+     * @param schedule The schedule to use.
+     */
+    void setSchedule(Schedule schedule) noexcept;
+
+    /**
+     * Gets the current schedule.
+     * @return The schedule.
+     */
+    Schedule getSchedule() const noexcept;
+
+    /**
+     * Gets the frame budget controller, which other threads may query for the active degradations.
+     * @return The controller.
+     */
+    const FrameBudget& getBudget() const noexcept;
+
+    /**
+     * Removes a ball, its slot is reused by the next ball spawned. Only called between steps.
+     * @note Slots are renumbered whenever the live balls are packed together.
+     * @param ball The ball slot index.
+     */
+    void removeBall(uint32_t ball) noexcept;
+
+    /**
+     * Gets the number of balls that have not been removed.
+     * @return The ball count.
+     */
+    uint32_t getLiveBalls() const noexcept;
+
 private:
     /* Add any required member variables here */
-	vector<Vector3> myballz;
-	vector<Vector3> myvelocityz;
+	//created on the thread running HPCEngine::run, which is pinned if a render core is reserved
+	ThreadPool threads{ ThreadPool::Config{ HPC_THREADS, ThreadPool::Affinity::HPC_AFFINITY, HPC_RESERVE_RENDER_CORE,
+		HPC_BACKGROUND_THREADS } };
+	ParticleArena m_arena{ HPC_ARENA_BALLS * sizeof(Vector3), s_arenaArrays }; /**< Fixed range the ball arrays live in */
+	NumaStorage m_numa{ threads, HPC_NUMA_STORAGE }; /**< Places the ball arrays, declared before them */
+
+	/** Number of ball arrays placed in the arena */
+	static const uint32_t s_arenaArrays = 5;
+
+	using BallArray = ChunkedArray<Vector3>;
+	BallArray myballz{ &m_numa };
+	BallArray myvelocityz{ &m_numa };
+
+	BallArray myballz2{ &m_numa };
+	BallArray myvelocityz2{ &m_numa };
+
+	BallArray m_forces{ &m_numa }; /**< Per ball acceleration used by the two pass integration */
+	vector<uint32_t> m_ballCost; /**< Number of contacts each ball had in the last contact pass */
+
+	Solver m_solver = HPC_USE_XPBD ? Solver::XPBD : Solver::Force; /**< The active simulation engine */
+	Integration m_integration = HPC_TWO_PASS ? Integration::TwoPass : Integration::DoubleBuffered; /**< The force solver integration mode */
+	Schedule m_schedule = Schedule::HPC_SCHEDULE; /**< How per ball work is shared between threads */
+	vector<uint64_t> m_costPrefix;  /**< Inclusive prefix sum of the estimated cost of each ball */
+	vector<uint32_t> m_costSplits;  /**< Boundaries of the equal cost ranges (first 0, last the ball count) */
+	float m_statsTime = 0.0f;  /**< Elapsed time since the solver stats were last logged */
+
+	//Long range state
+	BarnesHut m_tree{ threads };            /**< Octree used for the long range term */
+	bool m_longRange = HPC_LONG_RANGE;      /**< Whether the long range term is added */
+	vector<Vector3> m_longRangeAccel;       /**< Long range acceleration of each ball */
+	vector<Vector3> m_treePositions;        /**< Contiguous copy of the positions the tree is built from */
 
-	vector<Vector3> myballz2;
-	vector<Vector3> myvelocityz2;
+	//Frame pipeline state
+	TaskGraph m_graph{ threads };           /**< The stages of a step and their dependencies */
+	float m_stepTime = 0.0f;                /**< Elapsed time of the step being run */
+	Vector3 m_stepGravity;                  /**< Gravity of the step being run */
+	bool m_stepAddBalls = false;            /**< If balls are spawned by the step being run */
+	float m_statsElapsed = 0.0f;            /**< Elapsed time passed to the stats stage (it may overlap the next step) */
 
-	ThreadPool threads;
-	
+	//Frame budget state
+	FrameBudget m_budget{ HPC_FRAME_BUDGET, HPC_BUDGET_LEVELS }; /**< Reduces quality when steps run over budget */
+	vector<uint8_t> m_restSteps;            /**< Consecutive steps each ball has been at rest (saturating) */
+	uint32_t m_stepCount = 0;               /**< Number of steps run, staggers when sleeping balls are checked */
+	bool m_skipSleeping = false;            /**< If balls at rest are only updated every s_sleepCheck steps */
+
+	/** Steps a ball must be at rest before it sleeps */
+	static const uint8_t s_sleepSteps = 32;
+	/** Sleeping balls are fully updated once every this many steps, in case something hit them */
+	static const uint32_t s_sleepCheck = 8;
+
+	//Granularity state
+	Granularity m_granularity;              /**< Picks how many threads each pass runs on, calibrated in load() */
+	AutoTuner m_tuner{ AutoTuner::Settings{ 2, HPC_SCHEDULE_GRAIN, static_cast<uint32_t>(threads.size() + 1) },
+		static_cast<uint32_t>(threads.size() + 1), HPC_AUTO_TUNE }; /**< Tunes the chunk count, grain and threads */
+	string m_tuningCache;                   /**< Path of the tuning cache file (empty for none) */
+
+	//XPBD state
+	struct XPBDChunk
+	{
+		vector<uint32_t> m_contacts; /**< Contact ball indices for every ball in the chunk */
+		vector<float> m_lambdas;     /**< Accumulated lagrange multiplier of each contact */
+		float m_residual;            /**< Largest constraint violation seen by the last iteration */
+	};
+	vector<XPBDChunk> m_xpbdChunks;    /**< Per chunk contact storage */
+
+	/** Contacts per ball the chunk storage is sized for up front */
+	static const uint32_t s_contactsPerBall = 16;
+	vector<uint32_t> m_contactBegin;   /**< First contact of each ball within its chunk */
+	vector<uint32_t> m_contactEnd;     /**< One past the last contact of each ball within its chunk */
+	vector<Vector3> m_wallLambdaLow;   /**< Accumulated multipliers of the -40 walls */
+	vector<Vector3> m_wallLambdaHigh;  /**< Accumulated multipliers of the +40 walls */
+	BallArray m_xpbdScratch{ &m_numa };/**< Jacobi iteration ping-pong positions */
+	uint32_t m_xpbdIterations = HPC_XPBD_ITERATIONS; /**< Constraint iterations per step (set between steps) */
+	uint32_t m_xpbdStepIterations = 0; /**< Constraint iterations the last step ran */
+	float m_xpbdResidual = 0.0f;       /**< Largest constraint violation after the last step */
+
+	//Continuous collision state
+	bool m_ccd = HPC_USE_CCD;              /**< Whether fast balls are swept for tunnelling */
+	vector<vector<uint32_t>> m_ccdFound;   /**< Per chunk list of balls moving fast enough to tunnel */
+	vector<uint32_t> m_ccdBalls;           /**< All balls moving fast enough to tunnel */
+	Vector3* m_ccdPositions = nullptr;     /**< Swept position of each fast ball (in the frame arena) */
+	Vector3* m_ccdVelocities = nullptr;    /**< Swept velocity of each fast ball (in the frame arena) */
+
+	//Frame memory state
+	FrameArena m_frameArena;               /**< Temporaries of the step being run, reset at the start of each step */
+	uint32_t m_warmupSteps = s_warmupSteps; /**< Steps left that may allocate while buffers grow (checked in debug builds) */
+
+	/** Steps after loading, spawning balls or changing settings during which the frame loop's buffers may still grow */
+	static const uint32_t s_warmupSteps = 60;
+
+	//Removal state
+	vector<uint32_t> m_freeBalls;           /**< Slots of removed balls, reused by the next balls spawned */
+	vector<uint32_t> m_spawnSerial;         /**< Order each ball was spawned in, the oldest are removed first */
+	uint32_t m_nextSerial = 0;              /**< Serial of the next ball spawned */
+	vector<vector<uint32_t>> m_removeFound; /**< Per chunk list of balls to remove */
+	vector<uint32_t> m_packedIndex;         /**< Index of each live ball once packed together */
+	uint32_t m_renderLayout = 0;            /**< Changed whenever a live ball moves to another render index */
+	uint32_t m_compactions = 0;             /**< Times the balls were packed */
+	uint32_t m_statsLive = 0;               /**< Live balls after the step the stats stage reports */
+	uint32_t m_statsFree = 0;               /**< Free slots after the step the stats stage reports */
+	uint32_t m_statsCompactions = 0;        /**< m_compactions after the step the stats stage reports */
+	uint32_t m_reportedCompactions = 0;     /**< m_statsCompactions when the stats were last logged (stats stage) */
+
+	/** Rest count marking a removed ball, which never wakes */
+	static const uint8_t s_removed = 255;
+	/** Steps between checks for balls that have left the box */
+	static const uint32_t s_escapeCheck = 16;
 
 	void addBalls();
+	void spawnBall(const Vector3& position);
+	void removeEscaped();
+	void removeOldest(uint32_t incoming);
+	void compactBalls();
+	void packRenderData();
+	void resizeBuffers();
+	Vector3 ballAcceleration(uint32_t current, const Vector3* gravityVec);
 	void doSomeBallStuff(uint32_t start, uint32_t end, const float elapsedTime, const Vector3* gravityVec);
+	void computeForces(uint32_t start, uint32_t end, const Vector3* gravityVec);
+	void integrate(uint32_t start, uint32_t end, const float elapsedTime);
+
+	void xpbdPredict(uint32_t start, uint32_t end, const float elapsedTime, const Vector3* gravityVec);
+	void xpbdGather(uint32_t chunk, uint32_t start, uint32_t end);
+	void xpbdIterate(uint32_t chunk, uint32_t start, uint32_t end, const float elapsedTime, const BallArray& in,
+		BallArray& out);
+	void xpbdFinalise(uint32_t start, uint32_t end, const float elapsedTime, const BallArray& result);
+	void runXPBD(const float elapsedTime, const Vector3* gravityVec);
+
+	void ccdSweep(uint32_t first, uint32_t last, const float elapsedTime, const BallArray& positions,
+		const BallArray& velocities);
+	void runCCD(const float elapsedTime, BallArray& positions, BallArray& velocities);
+
+	void buildGraph();
+	void stepContacts();
+	void stepIntegrate();
+	void updatePartition();
+	void runLongRange();
+	void reportStats(float elapsedTime);
+	void applyBudget();
+	void applyTuning();
+
+	/**
+	 * Checks if a ball slot has been removed and not yet reused.
+	 * @param ball The ball index.
+	 * @return True if removed.
+	 */
+	bool isRemoved(uint32_t ball) const
+	{
+		return m_restSteps[ball] == s_removed;
+	}
+
+	/**
+	 * Checks if a ball is skipped by this step because it is asleep or removed.
+	 * @param ball The ball index.
+	 * @return True if it is not updated.
+	 */
+	bool isSleeping(uint32_t ball) const
+	{
+		return isRemoved(ball) ||
+			(m_skipSleeping && m_restSteps[ball] >= s_sleepSteps && (ball + m_stepCount) % s_sleepCheck != 0);
+	}
+
+	/**
+	 * Calls func(ball) on every ball matching a predicate, which is tested in parallel.
+	 * @param pred Tests a ball index.
+	 * @param func Called in index order for each match.
+	 */
+	template<class P, class F>
+	void forEachMatch(P&& pred, F&& func)
+	{
+		m_removeFound.resize(chunkCount(myballz.size()));
+		const uint32_t numChunks = runChunks([&](uint32_t chunk, uint32_t start, uint32_t end) {
+			vector<uint32_t>& found = m_removeFound[chunk];
+			found.clear();
+			for (uint32_t current = start; current < end; current++) {
+				if (pred(current)) {
+					found.push_back(current);
+				}
+			}
+		}, ballWork());
+		for (uint32_t i = 0; i < numChunks; i++) {
+			for (const uint32_t ball : m_removeFound[i]) {
+				func(ball);
+			}
+		}
+	}
+
+	/**
+	 * Records if a ball was at rest after its update.
+	 * @param ball     The ball index.
+	 * @param velocity The new velocity of the ball.
+	 */
+	void updateRest(uint32_t ball, const Vector3& velocity)
+	{
+		const bool resting = velocity.length().getX() < HPC_SLEEP_SPEED;
+		m_restSteps[ball] = resting ? static_cast<uint8_t>(min(m_restSteps[ball] + 1, s_removed - 1)) : 0;
+	}
+
+	/**
+	 * Gets the estimated cost of a pass item that tests every ball for contact.
+	 * @return The cost in nanoseconds.
+	 */
+	double contactWork() const
+	{
+		return m_granularity.getPairCost() * myballz.size();
+	}
+
+	/**
+	 * Gets the estimated cost of a pass item that only updates one ball.
+	 * @return The cost in nanoseconds.
+	 */
+	double ballWork() const
+	{
+		return m_granularity.getUpdateCost();
+	}
+
+	/**
+	 * Gets the number of chunks a range is split into by runChunks(), the tuned number per thread
+	 * but never more than there are items. With NUMA storage each chunk is a block.
+	 * @param size The number of items in the range.
+	 * @return The chunk count.
+	 */
+	uint32_t chunkCount(size_t size) const
+	{
+		if (m_numa.isEnabled()) {
+			return static_cast<uint32_t>(max<size_t>((size + NumaStorage::s_blockBalls - 1) / NumaStorage::s_blockBalls, 1));
+		}
+		const AutoTuner::Settings& settings = m_tuner.getSettings();
+		return static_cast<uint32_t>(max<size_t>(min<size_t>(size, settings.m_threads * settings.m_chunksPerThread), 1));
+	}
+
+	/**
+	 * Splits a range into the standard chunks and runs func(chunk, start, end) for each
+	 * chunk, returning once every chunk has completed. The chunks are the same however many
+	 * threads the pass is worth, small passes run every chunk on the calling thread.
+	 * @param size     The number of items in the range.
+	 * @param func     The function to run on each chunk.
+	 * @param itemCost The estimated cost of an item in nanoseconds.
+	 * @return The number of chunks that were used.
+	 */
+	template<class F>
+	uint32_t runChunks(size_t size, F&& func, double itemCost)
+	{
+		const uint32_t numChunks = chunkCount(size);
+		const uint64_t last = size;
+		const uint32_t participants = m_granularity.participants(static_cast<uint32_t>(size), itemCost);
+		if (m_numa.isEnabled()) {
+			//every block goes to the thread that placed it, unless that thread is busy
+			const uint32_t blockBalls = NumaStorage::s_blockBalls;
+			threads.parallel_for(0, numChunks, (participants == 1) ? numChunks : 1,
+				[&func, this, last, blockBalls](uint32_t first, uint32_t end) {
+				for (uint32_t i = first; i < end; i++) {
+					const uint32_t start = i * blockBalls;
+					const uint32_t stop = static_cast<uint32_t>(min<uint64_t>(start + blockBalls, last));
+					m_numa.countAccess(start, stop);
+					func(i, start, stop);
+				}
+			}, ThreadPool::Schedule::Owned);
+			return numChunks;
+		}
+		parallelChunks(threads, static_cast<uint32_t>(last), numChunks, [&func, this](uint32_t chunk, uint32_t start,
+			uint32_t stop) {
+			m_numa.countAccess(start, stop);
+			func(chunk, start, stop);
+		}, (numChunks + participants - 1) / participants);
+		return numChunks;
+	}
+
+	/**
+	 * Runs func(start, end) over every ball using the current schedule. Use runChunks() instead
+	 * when per chunk storage is needed as the ranges are not fixed.
+	 * @param func     The function to run on each range of balls.
+	 * @param ballCost The estimated cost of a ball in nanoseconds.
+	 */
+	template<class F>
+	void runBalls(F&& func, double ballCost)
+	{
+		const uint32_t size = static_cast<uint32_t>(myballz.size());
+		if (m_schedule == Schedule::Static || m_schedule == Schedule::CostModel || m_numa.isEnabled()) {
+			runChunks(size, [&func](uint32_t, uint32_t start, uint32_t end) { func(start, end); }, ballCost);
+		} else {
+			//when only some threads are worth using hand out no more claims than that
+			const uint32_t participants = m_granularity.participants(size, ballCost);
+			const uint32_t tunedGrain = m_tuner.getSettings().m_grain;
+			const uint32_t grain = (participants < m_granularity.getMaxParticipants())
+				? max((size + participants - 1) / participants, tunedGrain) : tunedGrain;
+			threads.parallel_for(0, size, grain, [&func, this](uint32_t start, uint32_t end) {
+				m_numa.countAccess(start, end);
+				func(start, end);
+			}, (m_schedule == Schedule::Guided) ? ThreadPool::Schedule::Guided : ThreadPool::Schedule::Dynamic);
+		}
+	}
+
+	/**
+	 * Runs func(start, end) over every ball for a pass whose cost depends on the number of
+	 * contacts. Uses the equal cost ranges from updatePartition() under the cost model schedule.
+	 * @param func The function to run on each range of balls.
+	 */
+	template<class F>
+	void runContacts(F&& func)
+	{
+		if (m_schedule != Schedule::CostModel || m_costSplits.empty() || m_costSplits.back() != myballz.size()
+			|| m_numa.isEnabled()) {
+			runBalls(forward<F>(func), contactWork());
+			return;
+		}
+		const uint32_t numRanges = static_cast<uint32_t>(m_costSplits.size() - 1);
+		const uint32_t participants = m_granularity.participants(static_cast<uint32_t>(myballz.size()), contactWork());
+		threads.parallel_for(0, numRanges, (numRanges + participants - 1) / participants,
+			[&func, this](uint32_t first, uint32_t last) {
+			for (uint32_t i = first; i < last; i++) {
+				m_numa.countAccess(m_costSplits[i], m_costSplits[i + 1]);
+				func(m_costSplits[i], m_costSplits[i + 1]);
+			}
+		});
+	}
+
+	/**
+	 * Runs func(chunk, start, end) over the standard chunks of the balls.
+	 * @param func     The function to run on each chunk.
+	 * @param ballCost The estimated cost of a ball in nanoseconds.
+	 * @return The number of chunks that were used.
+	 */
+	template<class F>
+	uint32_t runChunks(F&& func, double ballCost)
+	{
+		return runChunks(myballz.size(), forward<F>(func), ballCost);
+	}
 };
 #endif
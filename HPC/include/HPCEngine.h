@@ -16,9 +16,13 @@
 #ifndef HPCENGINE_H
 #define HPCENGINE_H
 #include "HPCAssignment.h"
+#include "TripleBuffer.h"
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <map>
 #include <string>
+#include <vector>
 class HPCVec3;
 
 class HPCEngine
@@ -91,22 +95,79 @@ public:
      * function is called the renderer will then render numRenderItems of spheres using the
      * information passed in through renderData. The input pointer does not have to be to an array
      * of RenderData items but it must be a pointer to a list of data that conforms with the layout
-     * assumed by RenderData. This function runs asynchronously so renderData must remain valid
-     * until the next frame.
+     * assumed by RenderData. Called by the "render packing" stage of a step, on a pool worker, the
+     * data is copied and published to the render thread so renderData only needs to remain valid for
+     * the duration of the call. It also reads the simulation thread's tick fraction, tick time and
+     * rotation angle, which is only safe because HPCAssignment::run() waits for that stage before the
+     * simulation thread changes them. The renderer keeps the previous update so that it can
+     * interpolate between the last two states.
      * @param renderData     Pointer to array of data holding new updated values.
      * @param numRenderItems The number of render items in the update array.
+     * @param layout         Changed whenever an item moves to another index, states with different layouts are
+     *                       not interpolated between.
      */
-    static void updateRenderData(const RenderData* renderData, uint32_t numRenderItems) noexcept;
+    static void updateRenderData(const RenderData* renderData, uint32_t numRenderItems, uint32_t layout = 0) noexcept;
+
+    /**
+     * Updates the render data from a list held in equal sized blocks, as updateRenderData().
+     * @param blocks         Pointer to the start of each block.
+     * @param blockItems     The number of render items in each block (the last may hold fewer).
+     * @param numRenderItems The number of render items in all the blocks.
+     * @param layout         Changed whenever an item moves to another index.
+     */
+    static void updateRenderData(const RenderData* const* blocks, uint32_t blockItems,
+        uint32_t numRenderItems, uint32_t layout = 0) noexcept;
 
 private:
-    bool m_shutdown = false;      /**< Variable indicating if engine should terminate */
-    float m_rotationAngle = 0.0f; /**< The current gravity rotation angle */
+    /** Requests passed from the render thread to the simulation thread. */
+    enum Command : uint32_t
+    {
+        AddBalls = 1,
+        ToggleSolver = 2,
+        ToggleLongRange = 4,
+        CycleSchedule = 8,
+        ToggleGravity = 16
+    };
+
+    /** A completed simulation step handed from the simulation thread to the render thread. */
+    struct SimulationFrame
+    {
+        uint32_t m_state = 0;                        /**< Index of the sphere states in m_tickStates */
+        uint32_t m_layout = 0;                       /**< Layout of the sphere states */
+        uint32_t m_previousState = 0;                /**< Index of the sphere states of the tick before */
+        uint32_t m_previousLayout = 0;               /**< Layout of the sphere states of the tick before */
+        float m_rotationAngle = 0.0f;                /**< Gravity rotation angle used by the step */
+        float m_tickFraction = 1.0f;                 /**< Fraction of the next tick the simulation clock was
+                                                          past the step at m_time */
+        std::chrono::steady_clock::time_point m_time; /**< When the simulation clock was read for the step */
+    };
+
+    std::atomic<bool> m_shutdown{ false }; /**< Variable indicating if engine should terminate */
+    float m_rotationAngle = 0.0f; /**< The current gravity rotation angle (simulation thread) */
     float m_rotationSign = 1.0f;  /**< The current gravity rotation angle direction of change */
     bool m_updateGravity = true;  /**< Variable indicating if gravity should be rotated */
-    HPCAssignment m_assignment;   /**< The assignment state */
-    const RenderData* m_renderData = nullptr; /**< Pointer to external sphere position list */
+    HPCAssignment m_assignment;   /**< The assignment state (simulation thread) */
+    std::atomic<uint32_t> m_commands{ 0 }; /**< Pending Command flags for the simulation thread */
+    TripleBuffer<SimulationFrame> m_frames; /**< Completed steps published by the simulation thread */
     uint32_t m_numSpheres = 0;    /**< Number of spheres to be rendered */
-    uint32_t m_frameNumber = 0;   /**< Number of frames since last FPS update */
+    /** Sphere state buffers, the two published frames refer to at most four and one more is written */
+    static const uint32_t s_tickStates = 5;
+
+    std::vector<RenderData> m_tickStates[s_tickStates]; /**< Sphere states of recent steps, each written once
+                                                             by the render packing stage then only read */
+    uint32_t m_renderStates[2] = { 0, 0 }; /**< m_tickStates index of the previous (0) and current (1) states */
+    uint32_t m_renderLayouts[2] = { 0, 0 }; /**< Layout of the previous (0) and current (1) simulation states */
+    uint32_t m_lastState = 0;     /**< m_tickStates index of the last published states (render packing stage) */
+    uint32_t m_lastLayout = 0;    /**< Layout of m_lastState (render packing stage) */
+    float m_tickFraction = 1.0f;  /**< Fraction of the next tick past the step being run (simulation thread) */
+    std::chrono::steady_clock::time_point m_tickTime; /**< When m_tickFraction was measured (simulation thread) */
+    float m_stateFraction = 1.0f; /**< Fraction of the next tick past the current state at m_stateTime */
+    float m_renderAngle = 0.0f;   /**< Gravity rotation angle of the current simulation state */
+    std::chrono::steady_clock::time_point m_stateTime; /**< When the simulation clock was read for the current state */
+    float m_renderAlpha = 1.0f;   /**< Fraction of a simulation tick to blend past the previous state */
+    float m_simulationTime = 0.0f; /**< Elapsed time not yet consumed by a simulation step */
+    bool m_deferredStep = false;  /**< If the last frame's time was left for the next coarse step (no fixed rate) */
+    std::atomic<uint32_t> m_frameNumber{ 0 }; /**< Number of simulation steps since last FPS update */
 
     // Data required for frame rate calculations
     float m_renderTime = 0.0f;  /**< Elapsed time since last render update */
@@ -161,6 +222,12 @@ private:
         float m_textureInstance;
     };
 
+    /**
+     * Runs the simulation until shutdown.
+     * @note Runs on its own thread, publishing each completed step to m_frames.
+     */
+    void simulate() noexcept;
+
     /**
      * Initialise required OpenGL data.
      * @return True if it succeeds, false if it fails.
@@ -202,7 +269,11 @@ private:
     /** Perform required OpenGL rendering operations. */
     void glRender() noexcept;
 
-    /** Perform required OpenGL operations to render the spheres. */
+    /**
+     * Perform required OpenGL operations to render the spheres.
+     * @note The instance buffer is built by blending the previous and current simulation states
+     * using m_renderAlpha.
+     */
     void glRenderSpheres() const noexcept;
 
     /** Perform required OpenGL operations to render the text overlay. */
@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <immintrin.h>
+
+using namespace std;
+
+/**
+ * Counts outstanding tasks so a thread can wait for all of them, without the per task shared
+ * state of a future. Tasks are added before they are submitted and count down as they complete.
+ * Unlike std::latch it can be added to while in use and reused once it reaches zero. A waiter may
+ * destroy the latch as soon as waiting returns, so waiting also lasts until every countDown() has
+ * finished touching it.
+ */
+class Latch
+{
+public:
+
+	/**
+	* Constructor.
+	* @param count The initial number of outstanding tasks.
+	*/
+	explicit Latch(uint32_t count = 0)
+		: m_count(count)
+	{
+	}
+
+	Latch(const Latch& other) = delete;
+
+	Latch& operator=(const Latch& other) = delete;
+
+	/**
+	* Adds outstanding tasks.
+	* @param count The number of tasks.
+	*/
+	void add(uint32_t count = 1)
+	{
+		m_count.fetch_add(count, memory_order_relaxed);
+	}
+
+	/** Marks one task as complete, waking the waiters if it was the last. */
+	void countDown()
+	{
+		//registered before the count can reach 0, the latch is not touched after leaving
+		m_counting.fetch_add(1);
+		if (m_count.fetch_sub(1) == 1) {
+			m_count.notify_all();
+		}
+		m_counting.fetch_sub(1);
+	}
+
+	/**
+	* Checks if every task has completed.
+	* @return True if none are outstanding and the latch may be destroyed.
+	*/
+	bool tryWait() const
+	{
+		return m_count.load() == 0 && m_counting.load() == 0;
+	}
+
+	/** Waits for every task to complete, spinning briefly before sleeping. */
+	void wait() const
+	{
+		for (uint32_t spin = 0; spin < s_spinCount; spin++) {
+			if (tryWait()) {
+				return;
+			}
+			_mm_pause();
+		}
+		uint32_t count;
+		while ((count = m_count.load()) != 0) {
+			m_count.wait(count);
+		}
+		//the last countDown() is at most a notify away from leaving
+		while (m_counting.load() != 0) {
+			_mm_pause();
+		}
+	}
+
+private:
+
+	/** Number of pause iterations spent checking before sleeping */
+	static const uint32_t s_spinCount = 256;
+
+	atomic<uint32_t> m_count;          /**< Number of outstanding tasks */
+	atomic<uint32_t> m_counting = 0;   /**< Number of countDown() calls still inside the latch */
+};
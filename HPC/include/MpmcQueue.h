@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+using namespace std;
+
+/**
+ * Bounded lock free multi producer multi consumer queue (Vyukov's array queue). Each slot carries
+ * a sequence number that tells producers and consumers whether it is free for the lap of the ring
+ * they are on, so a push or pop is one compare and swap on its cursor when uncontended. Only
+ * pointers are stored, nullptr is returned when nothing could be taken.
+ */
+template<class T>
+class MpmcQueue
+{
+public:
+
+	/**
+	* Constructor.
+	* @param capacity The number of slots (must be a power of 2).
+	*/
+	explicit MpmcQueue(uint32_t capacity = 4096)
+		: m_mask(capacity - 1)
+		, m_slots(make_unique<Slot[]>(capacity))
+	{
+		for (uint32_t i = 0; i < capacity; i++) {
+			m_slots[i].m_sequence.store(i, memory_order_relaxed);
+		}
+	}
+
+	MpmcQueue(const MpmcQueue& other) = delete;
+
+	MpmcQueue& operator=(const MpmcQueue& other) = delete;
+
+	/**
+	* Pushes an item onto the back of the queue.
+	* @param item The item.
+	* @return False if the queue was full.
+	*/
+	bool push(T* item)
+	{
+		uint64_t position = m_back.load(memory_order_relaxed);
+		while (true) {
+			Slot& slot = m_slots[position & m_mask];
+			const uint64_t sequence = slot.m_sequence.load(memory_order_acquire);
+			const int64_t lap = static_cast<int64_t>(sequence - position);
+			if (lap == 0) {
+				//the slot is free on this lap, claim it
+				if (m_back.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+					slot.m_item = item;
+					slot.m_sequence.store(position + 1, memory_order_release);
+					return true;
+				}
+			} else if (lap < 0) {
+				//the slot still holds the item from the previous lap
+				return false;
+			} else {
+				position = m_back.load(memory_order_relaxed);
+			}
+		}
+	}
+
+	/**
+	* Pops the oldest item.
+	* @return The item or nullptr if empty.
+	*/
+	T* pop()
+	{
+		uint64_t position = m_front.load(memory_order_relaxed);
+		while (true) {
+			Slot& slot = m_slots[position & m_mask];
+			const uint64_t sequence = slot.m_sequence.load(memory_order_acquire);
+			const int64_t lap = static_cast<int64_t>(sequence - (position + 1));
+			if (lap == 0) {
+				if (m_front.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+					T* item = slot.m_item;
+					//free the slot for the next lap of the ring
+					slot.m_sequence.store(position + m_mask + 1, memory_order_release);
+					return item;
+				}
+			} else if (lap < 0) {
+				return nullptr;
+			} else {
+				position = m_front.load(memory_order_relaxed);
+			}
+		}
+	}
+
+	/**
+	* Gets the number of slots.
+	* @return The capacity.
+	*/
+	uint32_t capacity() const
+	{
+		return static_cast<uint32_t>(m_mask + 1);
+	}
+
+private:
+
+	struct Slot
+	{
+		atomic<uint64_t> m_sequence;   /**< Position the slot can next be pushed (equal) or popped (one past) at */
+		T* m_item = nullptr;           /**< The stored item */
+	};
+
+	const uint64_t m_mask;                  /**< Capacity - 1, maps positions to slots */
+	unique_ptr<Slot[]> m_slots;             /**< The ring of slots */
+	alignas(64) atomic<uint64_t> m_back = 0; /**< Position of the next push */
+	alignas(64) atomic<uint64_t> m_front = 0;/**< Position of the next pop */
+};
@@ -0,0 +1,136 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ParticleArena.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+/**
+ * Memory for per ball arrays placed for the threads that update it. Balls are grouped in blocks of
+ * one page of Vector3s and the blocks belong to the pool's workers in turn, the same order
+ * Schedule::Owned hands out claims in. When enabled, new arrays are mapped untouched and each
+ * thread writes its own blocks first so the OS places those pages on its package (first touch).
+ * Either way the package each block landed on is recorded so updates by a thread on another
+ * package can be counted as remote. Arrays are allocated a block at a time (see ChunkedArray) and
+ * placed in a slot of a ParticleArena while they fit.
+ */
+class NumaStorage
+{
+public:
+
+	/** Balls in a block, one page of Vector3s */
+	static const uint32_t s_blockBalls = 256;
+
+	/**
+	* Constructor.
+	* @param pool    The pool whose threads own the blocks.
+	* @param enabled False to allocate normally, pages are then placed by the allocating thread.
+	*/
+	NumaStorage(ThreadPool& pool, bool enabled);
+
+	/**
+	* Places arrays that fit in the slots of an arena.
+	* @param arena The arena (nullptr for none).
+	*/
+	void useArena(ParticleArena* arena);
+
+	/**
+	* Writes the first pages of every slot of the arena in parallel, split into blocks the same way
+	* runChunks splits the balls, so each page is faulted in and placed by the thread owning its
+	* first block before the balls are added.
+	* @param balls The number of balls to prefault each slot for (capped to the slot size).
+	* @return The number of pages written.
+	*/
+	size_t prefault(size_t balls);
+
+	/**
+	* Allocates a block of an array indexed by ball. The blocks of an array share a slot of the
+	* arena, at their offset within the array, while they fit.
+	* @param slot      The array's slot, taken with its first block (nullptr if it has none).
+	* @param firstBall The first ball in the block.
+	* @param bytes     The size of the block.
+	* @param itemSize  The size of each element.
+	* @return The memory.
+	*/
+	void* allocateBlock(void*& slot, size_t firstBall, size_t bytes, size_t itemSize);
+
+	/**
+	* Frees a block from allocateBlock().
+	* @param slot   The array's slot.
+	* @param memory The block.
+	* @param bytes  The size of the block.
+	*/
+	void freeBlock(void* slot, void* memory, size_t bytes);
+
+	/**
+	* Returns an array's slot to the arena once all its blocks are freed.
+	* @param slot The slot, set to nullptr.
+	*/
+	void releaseSlot(void*& slot);
+
+	/**
+	* Checks if arrays are first touched by the threads owning them.
+	* @return True if enabled.
+	*/
+	bool isEnabled() const;
+
+	/**
+	* Gets the number of packages (sockets) of the host.
+	* @return Number of packages.
+	*/
+	uint32_t packageCount() const;
+
+	/**
+	* Counts the balls of a range updated by the calling thread as local or remote.
+	* @param start The first ball.
+	* @param end   One past the last ball.
+	*/
+	void countAccess(uint32_t start, uint32_t end);
+
+	/**
+	* Takes the counts since the last call.
+	* @param local  Returned number of balls updated on the package holding them.
+	* @param remote Returned number of balls updated from another package.
+	*/
+	void takeAccesses(uint64_t& local, uint64_t& remote);
+
+private:
+
+	/** Size of the pages first touched */
+	static const size_t s_pageSize = 4096;
+
+	/**
+	* Allocates memory outside the arena for balls of an array.
+	* @param bytes     The size.
+	* @param itemSize  The size of each element.
+	* @param firstBall The first ball held.
+	* @return The memory.
+	*/
+	void* allocate(size_t bytes, size_t itemSize, size_t firstBall);
+
+	/**
+	* Frees memory from allocate().
+	* @param memory The memory.
+	* @param bytes  The size passed to allocate().
+	*/
+	void deallocate(void* memory, size_t bytes);
+
+	/**
+	* Records the package of the calling thread as the home of the blocks of an array.
+	* @param first The first block.
+	* @param last  One past the last block.
+	*/
+	void setHome(size_t first, size_t last);
+
+	ThreadPool& m_pool;             /**< The pool whose threads own the blocks */
+	ParticleArena* m_arena = nullptr;/**< Arena arrays are placed in when they fit */
+	size_t m_prefaulted = 0;        /**< Bytes of each arena slot already placed */
+	bool m_enabled;                 /**< Whether arrays are first touched by their owners */
+	uint32_t m_packages;            /**< Number of packages of the host */
+	vector<uint32_t> m_blockHome;   /**< Package each block was last placed on */
+	atomic<uint64_t> m_local = 0;   /**< Balls updated on the package holding them */
+	atomic<uint64_t> m_remote = 0;  /**< Balls updated from another package */
+};
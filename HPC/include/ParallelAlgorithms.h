@@ -0,0 +1,284 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace std;
+
+/**
+ * Parallel building blocks on a ThreadPool. Each splits its items into a fixed set of contiguous
+ * chunks (so results do not depend on which thread ran what) and runs the chunks with
+ * parallel_for. Items are addressed by index so the same call works on arrays of structures
+ * such as vector<Vector3> and on separate arrays of each member. Per chunk temporaries live in the
+ * calling thread's scratch arena so the algorithms do not allocate.
+ */
+
+/** Fewest items worth giving a chunk of their own */
+static const uint32_t s_parallelMinChunk = 2048;
+
+/**
+* Gets the number of chunks an algorithm splits a range into.
+* @param pool  The pool the chunks run on.
+* @param count The number of items.
+* @return The number of chunks (at least 1).
+*/
+inline uint32_t parallelChunkCount(const ThreadPool& pool, uint32_t count)
+{
+	const uint32_t maxChunks = static_cast<uint32_t>(pool.size() + 1) * 4;
+	return max(min((count + s_parallelMinChunk - 1) / s_parallelMinChunk, maxChunks), 1U);
+}
+
+/**
+* Runs func(chunk, start, end) over each chunk of [0, count) on the pool.
+* @param pool   The pool.
+* @param count  The number of items.
+* @param chunks The number of chunks.
+* @param func   The function run on each chunk.
+* @param grain  The number of chunks claimed at a time.
+*/
+template<class F>
+void parallelChunks(ThreadPool& pool, uint32_t count, uint32_t chunks, F&& func, uint32_t grain = 1)
+{
+	pool.parallel_for(0, chunks, grain, [&func, count, chunks](uint32_t first, uint32_t last) {
+		for (uint32_t chunk = first; chunk < last; chunk++) {
+			func(chunk, static_cast<uint32_t>(static_cast<uint64_t>(count) * chunk / chunks),
+				static_cast<uint32_t>(static_cast<uint64_t>(count) * (chunk + 1) / chunks));
+		}
+	});
+}
+
+/**
+* Combines a value mapped from every item. Chunks are combined in order so the result only
+* depends on the item count and the pool size.
+* @param pool     The pool.
+* @param count    The number of items.
+* @param identity The value combining with any value to give that value.
+* @param map      Gets the value of an item from its index.
+* @param combine  Combines two values (must be associative).
+* @return The combined value (identity if there are no items).
+*/
+template<class T, class Map, class Combine>
+T parallel_reduce(ThreadPool& pool, uint32_t count, T identity, Map&& map, Combine&& combine)
+{
+	const uint32_t chunks = parallelChunkCount(pool, count);
+	FrameArena::Scope scope(pool.scratch());
+	ArenaVector<T> partials(chunks, identity, ArenaAllocator<T>(pool.scratch()));
+	parallelChunks(pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+		T value = identity;
+		for (uint32_t i = start; i < end; i++) {
+			value = combine(value, map(i));
+		}
+		partials[chunk] = value;
+	});
+	T value = identity;
+	for (const T& partial : partials) {
+		value = combine(value, partial);
+	}
+	return value;
+}
+
+/**
+* Writes the running combination of a value mapped from every item: sum each chunk, scan the
+* chunk sums, then offset every chunk by the sum of the chunks before it.
+* @param pool      The pool.
+* @param count     The number of items.
+* @param output    Receives the scan of each item (may be the array map reads from).
+* @param identity  The value combining with any value to give that value.
+* @param map       Gets the value of an item from its index.
+* @param combine   Combines two values (must be associative).
+* @param inclusive True to include each item in its own output, false for an exclusive scan.
+* @return The combination of every item.
+*/
+template<class T, class Map, class Combine>
+T parallel_scan(ThreadPool& pool, uint32_t count, T* output, T identity, Map&& map, Combine&& combine,
+	bool inclusive = true)
+{
+	const uint32_t chunks = parallelChunkCount(pool, count);
+	FrameArena::Scope scope(pool.scratch());
+	ArenaVector<T> offsets(chunks, identity, ArenaAllocator<T>(pool.scratch()));
+	parallelChunks(pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+		T sum = identity;
+		for (uint32_t i = start; i < end; i++) {
+			const T value = map(i);
+			if (inclusive) {
+				sum = combine(sum, value);
+				output[i] = sum;
+			} else {
+				output[i] = sum;
+				sum = combine(sum, value);
+			}
+		}
+		offsets[chunk] = sum;
+	});
+	T total = identity;
+	for (T& offset : offsets) {
+		const T sum = offset;
+		offset = total;
+		total = combine(total, sum);
+	}
+	//the first chunk has nothing before it
+	parallelChunks(pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+		if (chunk > 0) {
+			const T offset = offsets[chunk];
+			for (uint32_t i = start; i < end; i++) {
+				output[i] = combine(offset, output[i]);
+			}
+		}
+	});
+	return total;
+}
+
+/**
+* Scans an array.
+* @param pool      The pool.
+* @param input     The items.
+* @param output    Receives the scan of each item (may be input).
+* @param count     The number of items.
+* @param identity  The value combining with any value to give that value.
+* @param combine   Combines two values (must be associative).
+* @param inclusive True to include each item in its own output, false for an exclusive scan.
+* @return The combination of every item.
+*/
+template<class T, class Combine>
+T parallel_scan(ThreadPool& pool, const T* input, T* output, uint32_t count, T identity, Combine&& combine,
+	bool inclusive = true)
+{
+	return parallel_scan(pool, count, output, identity, [input](uint32_t i) { return input[i]; },
+		forward<Combine>(combine), inclusive);
+}
+
+/**
+* Sorts unsigned integer keys, moving a payload with each key. Least significant digit radix sort
+* of 8 bits a pass, stable, skipping passes where every key has the same digit.
+* @param pool         The pool.
+* @param keys         The keys, sorted on return.
+* @param values       The payload of each key (nullptr for none).
+* @param count        The number of keys.
+* @param keyScratch   Scratch space for count keys.
+* @param valueScratch Scratch space for count values (nullptr if there is no payload).
+*/
+template<class Key, class Value>
+void parallel_radix_sort(ThreadPool& pool, Key* keys, Value* values, uint32_t count, Key* keyScratch,
+	Value* valueScratch)
+{
+	static_assert(is_unsigned_v<Key>, "radix sort keys must be unsigned integers");
+	const uint32_t chunks = parallelChunkCount(pool, count);
+	FrameArena::Scope scope(pool.scratch());
+	ArenaVector<array<uint32_t, 256>> counts(chunks, ArenaAllocator<array<uint32_t, 256>>(pool.scratch()));
+	Key* keysFrom = keys;
+	Key* keysTo = keyScratch;
+	Value* valuesFrom = values;
+	Value* valuesTo = valueScratch;
+	for (uint32_t shift = 0; shift < sizeof(Key) * 8; shift += 8) {
+		parallelChunks(pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+			array<uint32_t, 256>& bucket = counts[chunk];
+			bucket.fill(0);
+			for (uint32_t i = start; i < end; i++) {
+				bucket[(keysFrom[i] >> shift) & 255]++;
+			}
+		});
+		//turn the counts into where each chunk writes each digit, digits first then chunks
+		uint32_t offset = 0;
+		bool skip = false;
+		for (uint32_t digit = 0; digit < 256 && !skip; digit++) {
+			const uint32_t digitStart = offset;
+			for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+				const uint32_t number = counts[chunk][digit];
+				counts[chunk][digit] = offset;
+				offset += number;
+			}
+			skip = digitStart == 0 && offset == count;
+		}
+		if (skip) {
+			continue;
+		}
+		parallelChunks(pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+			array<uint32_t, 256>& position = counts[chunk];
+			for (uint32_t i = start; i < end; i++) {
+				const uint32_t to = position[(keysFrom[i] >> shift) & 255]++;
+				keysTo[to] = keysFrom[i];
+				if (valuesFrom != nullptr) {
+					valuesTo[to] = valuesFrom[i];
+				}
+			}
+		});
+		swap(keysFrom, keysTo);
+		swap(valuesFrom, valuesTo);
+	}
+	//an odd number of passes leaves the result in the scratch space
+	if (keysFrom != keys) {
+		parallelChunks(pool, count, chunks, [&](uint32_t, uint32_t start, uint32_t end) {
+			copy(keysFrom + start, keysFrom + end, keys + start);
+			if (values != nullptr) {
+				copy(valuesFrom + start, valuesFrom + end, values + start);
+			}
+		});
+	}
+}
+
+/**
+* Sorts unsigned integer keys, moving a payload with each key, with scratch space from the calling
+* thread's scratch arena.
+* @param pool   The pool.
+* @param keys   The keys, sorted on return.
+* @param values The payload of each key.
+*/
+template<class Key, class Value>
+void parallel_radix_sort(ThreadPool& pool, vector<Key>& keys, vector<Value>& values)
+{
+	static_assert(is_trivially_copyable_v<Value>, "the scratch payload is not constructed");
+	FrameArena::Scope scope(pool.scratch());
+	Key* keyScratch = pool.scratch().allocate<Key>(keys.size());
+	Value* valueScratch = pool.scratch().allocate<Value>(values.size());
+	parallel_radix_sort(pool, keys.data(), values.empty() ? nullptr : values.data(),
+		static_cast<uint32_t>(keys.size()), keyScratch, values.empty() ? nullptr : valueScratch);
+}
+
+/**
+* Copies the items matching a predicate followed by the rest, keeping the order within each group.
+* To partition separate arrays of each member, partition an array of indices with a predicate
+* that looks up the members.
+* @param pool   The pool.
+* @param input  The items.
+* @param output Receives the partitioned items (must not overlap input).
+* @param count  The number of items.
+* @param pred   Returns true for the items placed first.
+* @return The number of items matching the predicate.
+*/
+template<class T, class Pred>
+uint32_t parallel_partition(ThreadPool& pool, const T* input, T* output, uint32_t count, Pred&& pred)
+{
+	const uint32_t chunks = parallelChunkCount(pool, count);
+	FrameArena::Scope scope(pool.scratch());
+	ArenaVector<uint32_t> matches(chunks, ArenaAllocator<uint32_t>(pool.scratch()));
+	parallelChunks(pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+		uint32_t number = 0;
+		for (uint32_t i = start; i < end; i++) {
+			number += pred(input[i]) ? 1 : 0;
+		}
+		matches[chunk] = number;
+	});
+	//matching items of each chunk follow those of earlier chunks, the rest follow every match
+	uint32_t total = 0;
+	for (uint32_t& number : matches) {
+		const uint32_t chunkMatches = number;
+		number = total;
+		total += chunkMatches;
+	}
+	parallelChunks(pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+		uint32_t matched = matches[chunk];
+		uint32_t rest = total + start - matched;
+		for (uint32_t i = start; i < end; i++) {
+			if (pred(input[i])) {
+				output[matched++] = input[i];
+			} else {
+				output[rest++] = input[i];
+			}
+		}
+	});
+	return total;
+}
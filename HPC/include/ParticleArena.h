@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/**
+ * A virtual address range reserved once for the per ball arrays, split into equal slots, one per
+ * array. Arrays that fit a slot never move as balls are added. The range is backed by 2 MB pages
+ * where the host allows it (hugetlbfs pages or transparent huge pages on Linux, large pages on
+ * Windows), cutting TLB misses in the pair loops, and falls back to normal pages otherwise.
+ */
+class ParticleArena
+{
+public:
+
+	/** The pages backing the arena. */
+	enum class Pages
+	{
+		Normal,      /**< Normal pages */
+		Transparent, /**< Normal pages the kernel is asked to merge into huge pages, which it may not do */
+		Huge         /**< Huge or large pages reserved by the system */
+	};
+
+	/** Size of a huge page */
+	static const size_t s_hugePageSize = 2 * 1024 * 1024;
+
+	/**
+	* Constructor, reserving the range.
+	* @param slotBytes The size of each slot (rounded up to whole huge pages, 0 for no arena).
+	* @param slots     The number of slots.
+	*/
+	ParticleArena(size_t slotBytes, uint32_t slots);
+
+	/** Destructor. */
+	~ParticleArena();
+
+	ParticleArena(const ParticleArena&) = delete;
+	ParticleArena& operator=(const ParticleArena&) = delete;
+
+	/**
+	* Takes a free slot.
+	* @param bytes The size needed.
+	* @return The slot, nullptr if it does not fit a slot or none are free.
+	*/
+	void* take(size_t bytes);
+
+	/**
+	* Returns a slot taken with take().
+	* @param memory The memory.
+	* @return False if the memory is not from the arena.
+	*/
+	bool give(void* memory);
+
+	/**
+	* Gets the start of a slot, for prefaulting.
+	* @param slot The slot index.
+	* @return The slot memory.
+	*/
+	char* getSlot(uint32_t slot) const;
+
+	/**
+	* Gets the number of slots.
+	* @return Number of slots (0 if the range could not be reserved).
+	*/
+	uint32_t getSlots() const;
+
+	/**
+	* Gets the size of each slot.
+	* @return The size in bytes.
+	*/
+	size_t getSlotBytes() const;
+
+	/**
+	* Gets the pages backing the arena.
+	* @return The kind of page.
+	*/
+	Pages getPages() const;
+
+	/**
+	* Gets the size of the pages backing the arena.
+	* @return The page size in bytes.
+	*/
+	size_t getPageSize() const;
+
+private:
+
+	/**
+	* Maps the range, trying huge pages first.
+	* @param bytes The size of the range.
+	* @return True if successful.
+	*/
+	bool map(size_t bytes);
+
+	char* m_base = nullptr;       /**< Start of the slots */
+	void* m_mapping = nullptr;    /**< The mapping (before alignment) */
+	size_t m_mappedBytes = 0;     /**< Size of the mapping */
+	size_t m_slotBytes = 0;       /**< Size of each slot */
+	Pages m_pages = Pages::Normal;/**< Pages backing the arena */
+	vector<bool> m_used;          /**< Whether each slot is taken */
+	mutex m_mutex;                /**< Guards m_used */
+};
@@ -0,0 +1,154 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+/**
+ * A move only void() callable. Callables of up to s_inlineSize bytes that can be moved without
+ * throwing are stored inside the task itself, larger ones on the heap. Unlike function, move only
+ * callables (such as lambdas owning a packaged_task) can be stored without a shared_ptr wrapper.
+ */
+class Task
+{
+public:
+
+	/** Bytes of callable stored without a heap allocation */
+	static const size_t s_inlineSize = 64;
+
+	/** Constructs an empty task. */
+	Task() noexcept = default;
+
+	/**
+	* Constructor.
+	* @param func The callable to run.
+	*/
+	template<class F, enable_if_t<!is_same_v<decay_t<F>, Task> && is_invocable_v<decay_t<F>&>, int> = 0>
+	Task(F&& func)
+	{
+		using Func = decay_t<F>;
+		if constexpr (sizeof(Func) <= s_inlineSize && alignof(Func) <= alignof(max_align_t)
+			&& is_nothrow_move_constructible_v<Func>) {
+			new (m_storage) Func(forward<F>(func));
+			m_ops = &Inline<Func>::s_ops;
+		} else {
+			*reinterpret_cast<Func**>(m_storage) = new Func(forward<F>(func));
+			m_ops = &Heap<Func>::s_ops;
+		}
+	}
+
+	Task(Task&& other) noexcept
+	{
+		moveFrom(other);
+	}
+
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			moveFrom(other);
+		}
+		return *this;
+	}
+
+	Task(const Task& other) = delete;
+
+	Task& operator=(const Task& other) = delete;
+
+	/** Destructor. */
+	~Task()
+	{
+		reset();
+	}
+
+	/**
+	* Checks if the task holds a callable.
+	* @return True if not empty.
+	*/
+	explicit operator bool() const noexcept
+	{
+		return m_ops != nullptr;
+	}
+
+	/** Runs the callable. */
+	void operator()()
+	{
+		m_ops->m_invoke(m_storage);
+	}
+
+private:
+
+	struct Ops
+	{
+		void (*m_invoke)(void*);                 /**< Calls the callable */
+		void (*m_move)(void*, void*) noexcept;   /**< Moves the callable between storages */
+		void (*m_destroy)(void*) noexcept;       /**< Destroys the callable */
+	};
+
+	/** Operations on a callable stored in m_storage. */
+	template<class Func>
+	struct Inline
+	{
+		static void invoke(void* storage)
+		{
+			(*static_cast<Func*>(storage))();
+		}
+
+		static void move(void* from, void* to) noexcept
+		{
+			new (to) Func(std::move(*static_cast<Func*>(from)));
+			static_cast<Func*>(from)->~Func();
+		}
+
+		static void destroy(void* storage) noexcept
+		{
+			static_cast<Func*>(storage)->~Func();
+		}
+
+		static constexpr Ops s_ops = { invoke, move, destroy };
+	};
+
+	/** Operations on a callable on the heap, m_storage holds its pointer. */
+	template<class Func>
+	struct Heap
+	{
+		static void invoke(void* storage)
+		{
+			(**static_cast<Func**>(storage))();
+		}
+
+		static void move(void* from, void* to) noexcept
+		{
+			*static_cast<Func**>(to) = *static_cast<Func**>(from);
+		}
+
+		static void destroy(void* storage) noexcept
+		{
+			delete *static_cast<Func**>(storage);
+		}
+
+		static constexpr Ops s_ops = { invoke, move, destroy };
+	};
+
+	void moveFrom(Task& other) noexcept
+	{
+		if (other.m_ops != nullptr) {
+			other.m_ops->m_move(other.m_storage, m_storage);
+			m_ops = other.m_ops;
+			other.m_ops = nullptr;
+		}
+	}
+
+	void reset() noexcept
+	{
+		if (m_ops != nullptr) {
+			m_ops->m_destroy(m_storage);
+			m_ops = nullptr;
+		}
+	}
+
+	const Ops* m_ops = nullptr;                               /**< Operations on the stored callable */
+	alignas(max_align_t) unsigned char m_storage[s_inlineSize]; /**< The callable or a pointer to it */
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace std;
+
+/**
+ * A graph of named stages run once per frame on a thread pool. Stages are declared once along
+ * with the stages they depend on in the same frame and in the previous frame. Each call to run()
+ * executes the next frame, starting every stage as soon as its dependencies have completed so
+ * independent stages overlap. A stage never overlaps its own previous frame. Stages that are not
+ * waited for may still be running when run() returns, overlapping the start of the next frame.
+ */
+class TaskGraph
+{
+public:
+
+	/** Timings of a stage. */
+	struct Timing
+	{
+		string m_name;      /**< The stage name */
+		uint64_t m_frames;  /**< Number of frames the stage has run */
+		double m_mean;      /**< Mean run time in milliseconds */
+		double m_start;     /**< Start of the last run in milliseconds after its frame began */
+		double m_end;       /**< End of the last run in milliseconds after its frame began */
+	};
+
+	/**
+	* Constructor.
+	* @param pool The pool stages are run on.
+	*/
+	explicit TaskGraph(ThreadPool& pool);
+
+	/** Destructor, waits for any stage still running. */
+	~TaskGraph();
+
+	/**
+	* Adds a stage to the graph. Must not be called while a frame is running.
+	* @param name         The name used for timings.
+	* @param work         The work done by the stage each frame.
+	* @param waitForFrame True if run() must wait for this stage, false to let it overlap the
+	*                     next frame (at most until the end of the next frame).
+	* @param priority     The pool lane the stage is queued in.
+	* @return The stage index used to add dependencies.
+	*/
+	uint32_t addStage(const string& name, function<void()> work, bool waitForFrame = true,
+		ThreadPool::Priority priority = ThreadPool::Priority::Frame);
+
+	/**
+	* Makes a stage wait for another within each frame.
+	* @param before The stage that must complete first.
+	* @param after  The stage that waits.
+	*/
+	void addDependency(uint32_t before, uint32_t after);
+
+	/**
+	* Makes a stage wait for another stage of the previous frame.
+	* @param before The stage that must complete first (in the previous frame).
+	* @param after  The stage that waits.
+	*/
+	void addFrameDependency(uint32_t before, uint32_t after);
+
+	/** Runs the next frame, returning once every waited for stage has completed. */
+	void run();
+
+	/** Waits for every stage of every frame to complete. */
+	void wait();
+
+	/**
+	* Gets the timings of every stage.
+	* @return The timings in the order stages were added.
+	*/
+	vector<Timing> timings() const;
+
+	/**
+	* Writes the timings of every stage to a comma separated file.
+	* @param fileName The file to write.
+	* @return True if successful.
+	*/
+	bool exportTimings(const string& fileName) const;
+
+private:
+
+	using clock_type = chrono::steady_clock;
+
+	struct Stage
+	{
+		string m_name;                 /**< The stage name */
+		function<void()> m_work;       /**< The stage work */
+		bool m_waitForFrame;           /**< If run() waits for the stage */
+		ThreadPool::Priority m_priority; /**< The pool lane the stage is queued in */
+		vector<uint32_t> m_next;       /**< Stages in the same frame waiting on this one */
+		vector<uint32_t> m_nextFrame;  /**< Stages in the next frame waiting on this one */
+		uint32_t m_dependencies = 0;   /**< Number of same frame dependencies */
+		vector<uint32_t> m_previousFrame; /**< Stages of the previous frame this one waits on */
+		uint32_t m_pending[2] = {};    /**< Unfinished dependencies, indexed by frame parity */
+		uint64_t m_completed = 0;      /**< Last frame completed (frames are numbered from 1) */
+		uint64_t m_frames = 0;         /**< Number of frames run */
+		double m_total = 0.0;          /**< Total run time in milliseconds */
+		double m_start = 0.0;          /**< Start of the last run relative to its frame */
+		double m_end = 0.0;            /**< End of the last run relative to its frame */
+	};
+
+	void launch(uint32_t stage, uint64_t frame);
+	void complete(uint32_t stage, uint64_t frame, double start, double end, ArenaVector<pair<uint32_t, uint64_t>>& ready);
+
+	ThreadPool& m_pool;                     /**< The pool stages run on */
+	vector<Stage> m_stages;                 /**< Every stage */
+	mutable mutex m_mutex;                  /**< Guards the scheduling state */
+	condition_variable m_done;              /**< Notified as frames complete */
+	uint64_t m_frame = 0;                   /**< The last frame started */
+	uint32_t m_remaining[2] = {};           /**< Stages left to complete, indexed by frame parity */
+	uint32_t m_waitRemaining[2] = {};       /**< Waited for stages left, indexed by frame parity */
+	clock_type::time_point m_frameStart[2]; /**< Start time, indexed by frame parity */
+};
@@ -1,87 +1,362 @@
-#pragma once
-#include <thread>
-#include <mutex>
-#include <vector>
-#include <queue>
-#include <atomic>
-#include <future>
-#include <iostream>
-
-
-
-using namespace std;
-
-class ThreadPool
-{
-public:
-
-	/** Constructor. */
-	ThreadPool();
-
-	/** Destructor. */
-	~ThreadPool();
-
-	/**
-	* Gets the number of threads in the pool.
-	* @return Number of threads.
-	*/
-	size_t size() const;
-
-	/** Stops the thread pool from processing or accepting any further jobs. */
-	void shutdown();
-
-	void threadFunc();
-
-	
-
-	vector<thread> m_threads;         /**< The threads */
-	queue<function<void()>> m_queue;  /**< The queue of pending tasks */
-	mutex m_mutex;                    /**< The mutex used to access the task queue */
-	condition_variable m_conditionVar;/**< The condition variable used to notify
-									  waiting threads of new work items */
-	atomic<bool> m_shutdown = false;  /**< Flag to immediately shutdown threads */
-	
-	/**
-	* Adds a work job onto the end of the queue.
-	* @param func New task function.
-	*/
-	void enqueueFunc(function<void()> func);
-
-	/**
-	* Adds a work job onto the end of the queue.
-	* @param func New task function.
-	* @param arg  The argument passed to the function.
-	* @return A future used to receive the input functions result.
-	*/
-	future<int> enqueueFunc(function<int(int)> func, int arg);
-
-
-	/**
-	* Adds a work job onto the end of the queue.
-	* @param func New task function.
-	* @param args Variable arguments for the associated function.
-	* @return A future used to retrieve the work items returned data (if any).
-	*/
-	/*template<class F, class... Args>
-	auto enqueue(F&& f, Args&&... args)->future<result_of_t<F(Args ...)>>*/
-
-	template<class F, class... Args>
-	auto enqueue(F&& f, Args&&... args) ->future<result_of_t<F(Args ...)>>
-	{
-		//Determine the return type of the task
-		using ReturnType = result_of_t<F(Args ...)>;
-		//Create a packaged task by binding the input task together
-		// with its input arguments
-		auto task = make_shared<packaged_task<ReturnType()>>(bind(forward<F>(f),
-			forward<Args>(args)...));
-		//Get the packaged_task's future
-		future<ReturnType> ret = task->get_future();
-		//Convert the packaged task to a void() function that can be passed to
-		// to the original enqueueFunc
-		enqueueFunc([task]() {
-			(*task)();
-		});
-		return ret;
-	}
-
-};
+#pragma once
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <chrono>
+#include "EventCount.h"
+#include "Latch.h"
+#include "MpmcQueue.h"
+#include "Task.h"
+#include "WorkStealingDeque.h"
+#include "CpuTopology.h"
+#include "FrameArena.h"
+
+
+
+using namespace std;
+
+class ThreadPool
+{
+public:
+
+	using Affinity = CpuTopology::Affinity;
+
+	/** How many threads the pool creates and where they run. */
+	struct Config
+	{
+		uint32_t m_threads = 0;               /**< Number of workers (0 for one per cpu the policy allows) */
+		Affinity m_affinity = Affinity::None; /**< Placement of the workers across the cpus */
+		bool m_reserveCaller = false;         /**< Pins the constructing thread to a physical core of
+											  its own and keeps the workers off it (with
+											  Affinity::None the workers may run on any other core) */
+		uint32_t m_backgroundThreads = 0;     /**< Most workers running background tasks at once
+											  (0 for half the workers, at least 1) */
+	};
+
+	/** The lanes tasks are queued in. */
+	enum class Priority
+	{
+		Frame,     /**< Work the current frame waits for, always taken first */
+		Background /**< Work that may be delayed (statistics, file output), only taken when no frame
+				   work is waiting and by at most m_backgroundLimit workers at once. A background
+				   task that has started runs to the end, frame work only goes first when a worker
+				   picks its next task */
+	};
+
+	/** Constructor. */
+	ThreadPool();
+
+	/**
+	* Constructor.
+	* @param config The size and placement of the workers.
+	*/
+	explicit ThreadPool(const Config& config);
+
+	/** Destructor. */
+	~ThreadPool();
+
+	/**
+	* Gets the number of threads in the pool.
+	* @return Number of threads.
+	*/
+	size_t size() const;
+
+	/**
+	* Gets the index of the calling thread, as used by Schedule::Owned.
+	* @return The worker index, or size() if the caller is not a worker of this pool.
+	*/
+	uint32_t currentThread() const;
+
+	/**
+	* Gets the package (socket) the calling thread is running on now.
+	* @return The package, 0 if it cannot be found.
+	*/
+	uint32_t currentPackage() const;
+
+	/**
+	* Gets the number of packages (sockets) of the host.
+	* @return Number of packages.
+	*/
+	uint32_t packageCount() const;
+
+	/**
+	* Gets the scratch arena of the calling thread, for temporaries such as pair lists or sort
+	* buffers. Users take a FrameArena::Scope so the arena is rewound when they finish, nested tasks
+	* run by a waiting worker then rewind in order. Threads that are not workers share the last
+	* arena, only the thread running the frame should use it.
+	* @return The arena.
+	*/
+	FrameArena& scratch();
+
+	/** The ways a parallel_for hands out its items. */
+	enum class Schedule
+	{
+		Dynamic, /**< Every claim takes grain items */
+		Guided,  /**< Claims take a share of the remaining items, shrinking down to grain items */
+		Owned    /**< Claims of grain items, counted from item 0, belong to the workers in turn
+				 by index, each worker takes its own before helping with the rest, so the same
+				 items go to the same workers whichever thread calls. A caller that is not a
+				 worker only helps (it owns every claim of a pool without workers) */
+	};
+
+	/** Time a thread spent working and waiting, in milliseconds. */
+	struct ThreadTime
+	{
+		double m_busy; /**< Time spent running tasks or parallel_for ranges */
+		double m_idle; /**< Time spent without work (waiting for other threads for the caller) */
+	};
+
+	/**
+	* Gets the busy and idle time of each worker since the last call, followed by the time
+	* threads calling parallel_for spent running ranges and waiting for the workers to finish.
+	* @return size() + 1 entries, the last being the calling threads.
+	*/
+	vector<ThreadTime> takeThreadTimes();
+
+	/** Stops the thread pool from processing or accepting any further jobs. */
+	void shutdown();
+
+	/**
+	* The worker loop. Frame tasks are taken from the workers own deque first, then the shared queue
+	* and finally stolen from a random other worker. Parallel_for ranges are joined next and
+	* background tasks are only taken when none of those are left, before sleeping.
+	* @param index The index of the worker.
+	*/
+	void threadFunc(uint32_t index);
+
+	/**
+	* Joins the current parallel_for if one has started since the worker last joined.
+	* @param index The index of the worker.
+	* @param seen  The last parallel_for epoch the worker joined, updated on joining.
+	* @return True if a parallel_for was joined.
+	*/
+	bool joinParallel(uint32_t index, uint32_t& seen);
+
+	/**
+	* Checks if there is a parallel_for the worker has not yet joined.
+	* @param seen The last parallel_for epoch the worker joined.
+	* @return True if there is one to join.
+	*/
+	bool parallelReady(uint32_t seen) const;
+
+	/**
+	* Claims and runs ranges of the current parallel_for until none are left.
+	* @param index The index of the thread (the worker index, size() for other threads).
+	*/
+	void workParallel(uint32_t index);
+
+	/**
+	* Gets the number of threads owning claims of an owned parallel_for.
+	* @return The number of workers, or 1 if there are none and the caller owns every claim.
+	*/
+	uint32_t ownerCount() const;
+
+	/**
+	* Claims the next range of an owned parallel_for belonging to a thread.
+	* @param owner The index of the thread owning the ranges.
+	* @param start Returned first item.
+	* @param last  Returned one past the last item.
+	* @return True if a range was claimed.
+	*/
+	bool claimOwned(uint32_t owner, uint32_t& start, uint32_t& last);
+
+	/**
+	* Finds the next task for a worker without blocking.
+	* @param index The index of the worker.
+	* @return The task or nullptr if none was found.
+	*/
+	Task* findTask(uint32_t index);
+
+	/**
+	* Takes the next background task if fewer than m_backgroundLimit workers are running one.
+	* @return The task or nullptr if none was taken, m_backgroundRunning is raised if one was.
+	*/
+	Task* findBackgroundTask();
+
+	/**
+	* Checks if a background task is waiting that a worker may take.
+	* @return True if one may be taken.
+	*/
+	bool backgroundReady() const;
+
+	/**
+	* Makes a task to queue, reusing a freed one if there is one.
+	* @param func The callable.
+	* @return The task.
+	*/
+	Task* makeTask(Task&& func);
+
+	/**
+	* Frees a task that has run, keeping it for reuse if there is room.
+	* @param task The task.
+	*/
+	void freeTask(Task* task);
+
+	/**
+	* Runs and frees a task taken by a worker.
+	* @param index The index of the worker.
+	* @param task  The task.
+	*/
+	void runTask(uint32_t index, Task* task);
+
+	/**
+	* Runs and frees a background task taken by findBackgroundTask().
+	* @param index The index of the worker.
+	* @param task  The task.
+	*/
+	void runBackgroundTask(uint32_t index, Task* task);
+
+	using Deque = WorkStealingDeque<Task>;
+
+	vector<thread> m_threads;         /**< The threads */
+	vector<unique_ptr<Deque>> m_deques;/**< Per worker deques of tasks submitted from inside tasks */
+	MpmcQueue<Task> m_queue;          /**< The queue of tasks submitted from outside the pool */
+	EventCount m_wake;                /**< Sleeping workers wait on this for new work */
+	atomic<bool> m_shutdown = false;  /**< Flag to immediately shutdown threads */
+	atomic<int64_t> m_pending = 0;    /**< Number of queued frame tasks not yet taken by a worker */
+	MpmcQueue<Task> m_backgroundQueue;/**< The queue of background tasks */
+	MpmcQueue<Task> m_freeTasks;      /**< Tasks that have run, reused so queueing does not allocate */
+	atomic<int64_t> m_backgroundPending = 0; /**< Number of queued background tasks */
+	atomic<uint32_t> m_backgroundRunning = 0;/**< Number of workers running a background task */
+	uint32_t m_backgroundLimit = 1;   /**< Most workers running background tasks at once */
+
+	using RangeFunc = void(*)(void*, uint32_t, uint32_t);
+	using clock_type = chrono::steady_clock;
+
+	struct alignas(64) OwnedCursor
+	{
+		atomic<uint32_t> m_next = 0;  /**< Number of the thread's claims taken */
+	};
+
+	struct alignas(64) ThreadClock
+	{
+		atomic<int64_t> m_busy = 0;   /**< Nanoseconds spent working */
+		atomic<int64_t> m_idle = 0;   /**< Nanoseconds spent waiting (calling threads only) */
+	};
+
+	/** Number of pause iterations idle threads spin for before sleeping */
+	static const uint32_t s_spinCount = 4096;
+
+	mutex m_parallelMutex;            /**< Held by the thread running a parallel_for */
+	RangeFunc m_rangeFunc = nullptr;  /**< The function of the current parallel_for */
+	void* m_rangeContext = nullptr;   /**< The context passed to m_rangeFunc */
+	uint32_t m_rangeEnd = 0;          /**< One past the last item of the current parallel_for */
+	uint32_t m_rangeGrain = 1;        /**< Number of items claimed at a time */
+	Schedule m_rangeSchedule = Schedule::Dynamic; /**< How the current parallel_for is handed out */
+	uint32_t m_rangeShare = 1;        /**< Guided claims take 1/m_rangeShare of the remaining items */
+	unique_ptr<ThreadClock[]> m_clocks;/**< Work times of each worker then the calling threads */
+	clock_type::time_point m_clockStart;/**< When the thread times were last taken */
+	atomic<uint32_t> m_epoch = 0;     /**< Incremented at the start and end of each parallel_for
+									  (odd while one is running) */
+	atomic<uint32_t> m_joined = 0;    /**< Number of workers inside the current parallel_for */
+	alignas(64) atomic<uint32_t> m_rangeNext = 0; /**< The next unclaimed item */
+	alignas(64) atomic<uint32_t> m_rangeDone = 0; /**< Number of items completed */
+	uint32_t m_rangeBegin = 0;        /**< The first item of the current parallel_for */
+	unique_ptr<OwnedCursor[]> m_owned;/**< Claims taken of each owner when owned */
+	vector<uint32_t> m_cpuPackages;   /**< The package of each logical processor */
+	unique_ptr<FrameArena[]> m_scratch;/**< Scratch arena of each worker then the other threads */
+	
+
+	/**
+	* Adds a work job onto the end of the queue.
+	* @param func     New task function.
+	* @param priority The lane the job is queued in.
+	*/
+	void enqueueFunc(Task func, Priority priority = Priority::Frame);
+
+	/**
+	* Adds a work job onto the end of the queue.
+	* @param func New task function.
+	* @param arg  The argument passed to the function.
+	* @return A future used to receive the input functions result.
+	*/
+	future<int> enqueueFunc(function<int(int)> func, int arg);
+
+
+	/**
+	* Adds a work job onto the end of the queue.
+	* @param func New task function.
+	* @param args Variable arguments for the associated function.
+	* @return A future used to retrieve the work items returned data (if any).
+	*/
+	/*template<class F, class... Args>
+	auto enqueue(F&& f, Args&&... args)->future<result_of_t<F(Args ...)>>*/
+
+	/**
+	* Runs fn(start, end) over [begin, end) split into ranges of grain items on the
+	* workers and the calling thread. Returns once every range has completed. No memory is
+	* allocated. May be called from a task. Nested calls, and calls made while another parallel_for
+	* is running, run inline.
+	* @param begin    The first item.
+	* @param end      One past the last item.
+	* @param grain    Number of items passed to each call of fn (the minimum when guided).
+	* @param fn       The function to run on each range.
+	* @param schedule How ranges are handed out.
+	*/
+	template<class F>
+	void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, F&& fn, Schedule schedule = Schedule::Dynamic)
+	{
+		using Func = remove_reference_t<F>;
+		parallelFor(begin, end, grain, [](void* context, uint32_t start, uint32_t last) {
+			(*static_cast<Func*>(context))(start, last);
+		}, const_cast<void*>(static_cast<const void*>(addressof(fn))), schedule);
+	}
+
+	/**
+	* Type erased implementation of parallel_for.
+	* @param begin    The first item.
+	* @param end      One past the last item.
+	* @param grain    Number of items passed to each call of func.
+	* @param func     The function to run on each range.
+	* @param context  The first argument passed to func.
+	* @param schedule How ranges are handed out.
+	*/
+	void parallelFor(uint32_t begin, uint32_t end, uint32_t grain, RangeFunc func, void* context,
+		Schedule schedule);
+
+	template<class F, class... Args>
+	auto enqueue(F&& f, Args&&... args) ->future<invoke_result_t<F, Args ...>>
+	{
+		//Determine the return type of the task
+		using ReturnType = invoke_result_t<F, Args ...>;
+		//Create a packaged task by binding the input task together
+		// with its input arguments
+		packaged_task<ReturnType()> task(bind(forward<F>(f), forward<Args>(args)...));
+		//Get the packaged_task's future
+		future<ReturnType> ret = task.get_future();
+		//Tasks are move only so the packaged task is moved in rather than shared
+		enqueueFunc([task = move(task)]() mutable {
+			task();
+		});
+		return ret;
+	}
+
+	/**
+	* Adds a work job onto the end of the queue, counted by a latch instead of returning a
+	* future. The latch is counted up here and down once the job has run.
+	* @param latch    The latch waited on for the job.
+	* @param func     New task function.
+	* @param priority The lane the job is queued in.
+	*/
+	template<class F>
+	void enqueue(Latch& latch, F&& func, Priority priority = Priority::Frame)
+	{
+		latch.add();
+		enqueueFunc([&latch, func = forward<F>(func)]() mutable {
+			func();
+			latch.countDown();
+		}, priority);
+	}
+
+	/**
+	* Waits for every job counted by a latch. Workers run other queued jobs while waiting so
+	* a job may wait for the jobs it submits. Only a background job helps with background work.
+	* @param latch The latch.
+	*/
+	void wait(Latch& latch);
+
+};
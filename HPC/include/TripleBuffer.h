@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * Lock free hand off of the newest complete value from one writer thread to one reader thread.
+ * The writer fills back() and publishes it, the reader picks up the newest published value with
+ * acquire() and reads front(). Neither side ever waits for the other or sees a partly written
+ * value, values published faster than they are acquired are dropped.
+ */
+template<class T>
+class TripleBuffer
+{
+public:
+
+	/**
+	* Gets the value the writer fills. Only called by the writer.
+	* @return The back value.
+	*/
+	T& back()
+	{
+		return m_buffers[m_back];
+	}
+
+	/**
+	* Gets one of the other two values, for a writer checking what the published values still refer
+	* to. Only called by the writer, which may only read the fields it filled itself.
+	* @param index 0 or 1.
+	* @return The middle or front value, in no particular order.
+	*/
+	const T& published(const uint32_t index) const
+	{
+		//the two indices other than m_back
+		return m_buffers[(m_back + 1 + index) % 3];
+	}
+
+	/** Publishes the back value as the newest complete value. Only called by the writer. */
+	void publish()
+	{
+		//swap the back and middle values, flagging the middle as unread
+		m_back = m_middle.exchange(m_back | s_dirty, memory_order_acq_rel) & s_index;
+	}
+
+	/**
+	* Picks up the newest published value if there is one. Only called by the reader.
+	* @return True if front() changed.
+	*/
+	bool acquire()
+	{
+		if ((m_middle.load(memory_order_relaxed) & s_dirty) == 0) {
+			return false;
+		}
+		m_front = m_middle.exchange(m_front, memory_order_acq_rel) & s_index;
+		return true;
+	}
+
+	/**
+	* Gets the value the reader uses. Only called by the reader.
+	* @return The front value, valid until the next acquire().
+	*/
+	T& front()
+	{
+		return m_buffers[m_front];
+	}
+
+private:
+
+	static const uint8_t s_index = 3; /**< Mask of the buffer index in m_middle */
+	static const uint8_t s_dirty = 4; /**< Flag set in m_middle when it holds an unread value */
+
+	T m_buffers[3];                         /**< The back, middle and front values */
+	alignas(64) uint8_t m_back = 0;         /**< Index of the back value (writer only) */
+	alignas(64) atomic<uint8_t> m_middle = 1; /**< Index of the middle value plus the unread flag */
+	alignas(64) uint8_t m_front = 2;        /**< Index of the front value (reader only) */
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Chase-Lev work stealing deque (using the C11 memory model version by Le et al).
+ * The owning thread pushes and pops at the bottom while any other thread may steal from
+ * the top. Only pointers are stored, nullptr is returned when nothing could be taken.
+ */
+template<class T>
+class WorkStealingDeque
+{
+public:
+
+	/**
+	* Constructor.
+	* @param capacity The initial capacity (must be a power of 2).
+	*/
+	explicit WorkStealingDeque(int64_t capacity = 256)
+	{
+		m_arrays.emplace_back(make_unique<Array>(capacity));
+		m_array.store(m_arrays.back().get(), memory_order_relaxed);
+	}
+
+	WorkStealingDeque(const WorkStealingDeque& other) = delete;
+
+	WorkStealingDeque& operator=(const WorkStealingDeque& other) = delete;
+
+	/**
+	* Pushes an item onto the bottom of the deque. Only called by the owner.
+	* @param item The item.
+	*/
+	void push(T* item)
+	{
+		const int64_t bottom = m_bottom.load(memory_order_relaxed);
+		const int64_t top = m_top.load(memory_order_acquire);
+		Array* array = m_array.load(memory_order_relaxed);
+		if (bottom - top > array->m_capacity - 1) {
+			array = grow(array, top, bottom);
+		}
+		array->put(bottom, item);
+		atomic_thread_fence(memory_order_release);
+		m_bottom.store(bottom + 1, memory_order_relaxed);
+	}
+
+	/**
+	* Pops the most recently pushed item. Only called by the owner.
+	* @return The item or nullptr if empty.
+	*/
+	T* pop()
+	{
+		const int64_t bottom = m_bottom.load(memory_order_relaxed) - 1;
+		Array* array = m_array.load(memory_order_relaxed);
+		m_bottom.store(bottom, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		int64_t top = m_top.load(memory_order_relaxed);
+		T* item = nullptr;
+		if (top <= bottom) {
+			item = array->get(bottom);
+			if (top == bottom) {
+				//last item, race any thieves for it
+				if (!m_top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+					item = nullptr;
+				}
+				m_bottom.store(bottom + 1, memory_order_relaxed);
+			}
+		} else {
+			m_bottom.store(bottom + 1, memory_order_relaxed);
+		}
+		return item;
+	}
+
+	/**
+	* Steals the oldest item. May be called by any thread.
+	* @return The item or nullptr if empty (or the steal lost a race).
+	*/
+	T* steal()
+	{
+		int64_t top = m_top.load(memory_order_acquire);
+		atomic_thread_fence(memory_order_seq_cst);
+		const int64_t bottom = m_bottom.load(memory_order_acquire);
+		if (top < bottom) {
+			T* item = m_array.load(memory_order_acquire)->get(top);
+			if (!m_top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+				return nullptr;
+			}
+			return item;
+		}
+		return nullptr;
+	}
+
+	/**
+	* Gets an estimate of the number of items.
+	* @return The number of items.
+	*/
+	int64_t size() const
+	{
+		return max<int64_t>(m_bottom.load(memory_order_relaxed) - m_top.load(memory_order_relaxed), 0);
+	}
+
+private:
+
+	struct Array
+	{
+		int64_t m_capacity;               /**< Number of slots (power of 2) */
+		unique_ptr<atomic<T*>[]> m_items; /**< The circular slot storage */
+
+		explicit Array(int64_t capacity)
+			: m_capacity(capacity)
+			, m_items(new atomic<T*>[capacity])
+		{}
+
+		T* get(int64_t index) const
+		{
+			return m_items[index & (m_capacity - 1)].load(memory_order_relaxed);
+		}
+
+		void put(int64_t index, T* item)
+		{
+			m_items[index & (m_capacity - 1)].store(item, memory_order_relaxed);
+		}
+	};
+
+	Array* grow(Array* array, int64_t top, int64_t bottom)
+	{
+		//old arrays are kept until destruction as thieves may still be reading them
+		m_arrays.emplace_back(make_unique<Array>(array->m_capacity * 2));
+		Array* grown = m_arrays.back().get();
+		for (int64_t i = top; i < bottom; i++) {
+			grown->put(i, array->get(i));
+		}
+		m_array.store(grown, memory_order_release);
+		return grown;
+	}
+
+	atomic<int64_t> m_top = 0;            /**< Index thieves steal from */
+	atomic<int64_t> m_bottom = 0;         /**< Index the owner pushes and pops at */
+	atomic<Array*> m_array;               /**< The current slot storage */
+	vector<unique_ptr<Array>> m_arrays;   /**< Every array ever used (owner only) */
+};
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "AllocationCounter.h"
+#ifdef _WIN32
+#    include <malloc.h>
+#endif
+
+using namespace std;
+
+/** Allocations made by tracked threads */
+static atomic<uint64_t> s_allocations = 0;
+/** Whether the current thread's allocations are counted */
+static thread_local bool t_tracked = false;
+
+void AllocationCounter::trackThread()
+{
+	t_tracked = true;
+}
+
+uint64_t AllocationCounter::count()
+{
+	return s_allocations.load(memory_order_relaxed);
+}
+
+AllocationCounter::Pause::Pause()
+	: m_tracked(t_tracked)
+{
+	t_tracked = false;
+}
+
+AllocationCounter::Pause::~Pause()
+{
+	t_tracked = m_tracked;
+}
+
+#if HPC_COUNT_ALLOCATIONS
+//the array and nothrow forms forward to these, the sized deletes are replaced too so they match
+void* operator new(size_t bytes)
+{
+	if (t_tracked) {
+		s_allocations.fetch_add(1, memory_order_relaxed);
+	}
+	void* memory = malloc(max<size_t>(bytes, 1));
+	if (memory == nullptr) {
+		throw bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+void* operator new(size_t bytes, align_val_t alignment)
+{
+	if (t_tracked) {
+		s_allocations.fetch_add(1, memory_order_relaxed);
+	}
+	const size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+	void* memory = _aligned_malloc(max<size_t>(bytes, 1), align);
+#else
+	void* memory = aligned_alloc(align, (max<size_t>(bytes, 1) + align - 1) / align * align);
+#endif
+	if (memory == nullptr) {
+		throw bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory, align_val_t) noexcept
+{
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+void operator delete(void* memory, size_t, align_val_t alignment) noexcept
+{
+	operator delete(memory, alignment);
+}
+#endif
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "AutoTuner.h"
+#include "HPCEngine.h"
+#ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <Windows.h>
+#else
+#    include <unistd.h>
+#endif
+
+using namespace std;
+
+AutoTuner::AutoTuner(const Settings& defaults, const uint32_t maxThreads, const bool enabled)
+	: m_defaults(defaults)
+	, m_maxThreads(max(maxThreads, 1U))
+	, m_enabled(enabled)
+{
+	m_defaults.m_threads = min(max(m_defaults.m_threads, 1U), m_maxThreads);
+	m_settings = m_defaults;
+}
+
+bool AutoTuner::select(const uint32_t balls)
+{
+	const uint32_t range = static_cast<uint32_t>(bit_width(balls));
+	if (range == m_range) {
+		return false;
+	}
+	m_range = range;
+	const Settings previous = m_settings;
+	const auto best = m_best.find(range);
+	m_settings = (best != m_best.end()) ? best->second.m_settings : m_defaults;
+	restart();
+	return !(m_settings == previous);
+}
+
+bool AutoTuner::update(const double stepTime)
+{
+	if (!m_enabled) {
+		return false;
+	}
+	if (m_skip > 0) {
+		m_skip--;
+		return false;
+	}
+	m_total += stepTime;
+	m_steps++;
+	if (m_phase == Phase::Waiting) {
+		if (m_steps >= s_intervalSteps) {
+			m_phase = Phase::Baseline;
+			m_steps = 0;
+			m_total = 0.0;
+		}
+		return false;
+	}
+	if (m_steps < s_windowSteps) {
+		return false;
+	}
+	const double mean = m_total / m_steps;
+	m_steps = 0;
+	m_total = 0.0;
+	if (m_phase == Phase::Baseline) {
+		m_baseline = mean;
+		const Settings trial = nextTrial();
+		if (trial == m_settings) {
+			m_phase = Phase::Waiting;
+			return false;
+		}
+		m_settings = trial;
+		m_phase = Phase::Trial;
+		m_skip = s_settleSteps;
+		return true;
+	}
+
+	//keep the trial if it beat the best settings, otherwise go back to them
+	m_phase = Phase::Waiting;
+	m_skip = s_settleSteps;
+	if (mean < m_baseline * (1.0 - s_margin)) {
+		m_best[m_range] = Entry{ m_settings, mean };
+		m_improved = true;
+		char buffer[160];
+		snprintf(buffer, sizeof(buffer),
+			"Auto tuner: under %u balls %u chunks a thread, grain %u, %u threads (%.3f ms from %.3f ms)\n",
+			1U << min(m_range, 31U), m_settings.m_chunksPerThread, m_settings.m_grain, m_settings.m_threads, mean,
+			m_baseline);
+		HPCEngine::logMessage(buffer);
+		return false;
+	}
+	const auto best = m_best.find(m_range);
+	m_settings = (best != m_best.end()) ? best->second.m_settings : m_defaults;
+	return true;
+}
+
+void AutoTuner::restart()
+{
+	m_phase = Phase::Waiting;
+	m_steps = 0;
+	m_total = 0.0;
+	m_skip = s_settleSteps;
+}
+
+const AutoTuner::Settings& AutoTuner::getSettings() const
+{
+	return m_settings;
+}
+
+AutoTuner::Settings AutoTuner::nextTrial()
+{
+	//each parameter down then up, skipping moves that leave its range
+	const uint32_t threadStep = max(m_maxThreads / 8, 1U);
+	for (uint32_t tried = 0; tried < 6; tried++) {
+		Settings trial = m_settings;
+		const uint32_t candidate = m_candidate++ % 6;
+		const bool up = (candidate & 1) != 0;
+		switch (candidate / 2) {
+		case 0:
+			trial.m_chunksPerThread = up ? min(trial.m_chunksPerThread * 2, 16U) : max(trial.m_chunksPerThread / 2, 1U);
+			break;
+		case 1:
+			trial.m_grain = up ? min(trial.m_grain * 2, 1024U) : max(trial.m_grain / 2, 4U);
+			break;
+		default:
+			trial.m_threads = up ? min(trial.m_threads + threadStep, m_maxThreads) :
+				max(trial.m_threads, threadStep + 1) - threadStep;
+			break;
+		}
+		if (!(trial == m_settings)) {
+			return trial;
+		}
+	}
+	return m_settings;
+}
+
+bool AutoTuner::hasImproved() const
+{
+	return m_improved;
+}
+
+string AutoTuner::cachePath(const string& fileName)
+{
+	if (fileName.empty() || filesystem::path(fileName).is_absolute()) {
+		return fileName;
+	}
+	char executable[4096];
+#ifdef _WIN32
+	const DWORD length = GetModuleFileNameA(nullptr, executable, sizeof(executable));
+	const size_t size = (length < sizeof(executable)) ? length : 0;
+#else
+	const ssize_t length = readlink("/proc/self/exe", executable, sizeof(executable));
+	const size_t size = (length > 0 && static_cast<size_t>(length) < sizeof(executable)) ? length : 0;
+#endif
+	//without the executable's path fall back to the working directory
+	if (size == 0) {
+		return fileName;
+	}
+	return (filesystem::path(string(executable, size)).parent_path() / fileName).string();
+}
+
+string AutoTuner::hostKey()
+{
+	char name[256] = "unknown";
+#ifdef _WIN32
+	DWORD size = sizeof(name);
+	GetComputerNameA(name, &size);
+#else
+	gethostname(name, sizeof(name) - 1);
+#endif
+	//spaces would split the cache line, the cpu count tells apart a machine that was resized
+	string key = name;
+	replace(key.begin(), key.end(), ' ', '_');
+	return key + "/" + to_string(thread::hardware_concurrency());
+}
+
+uint32_t AutoTuner::load(const string& fileName)
+{
+	ifstream file(fileName);
+	const string host = hostKey();
+	uint32_t count = 0;
+	string line;
+	while (getline(file, line)) {
+		istringstream fields(line);
+		string name;
+		uint32_t range;
+		Entry entry;
+		if (line.empty() || line[0] == '#' || !(fields >> name >> range >> entry.m_settings.m_chunksPerThread >>
+			entry.m_settings.m_grain >> entry.m_settings.m_threads >> entry.m_time) || name != host) {
+			continue;
+		}
+		//a cache written with a bigger pool is clamped to this one
+		entry.m_settings.m_chunksPerThread = max(entry.m_settings.m_chunksPerThread, 1U);
+		entry.m_settings.m_threads = min(max(entry.m_settings.m_threads, 1U), m_maxThreads);
+		m_best[range] = entry;
+		count++;
+	}
+	//the current range may now have tuned settings
+	m_range = UINT32_MAX;
+	return count;
+}
+
+bool AutoTuner::save(const string& fileName) const
+{
+	const string host = hostKey();
+	vector<string> lines;
+	{
+		ifstream file(fileName);
+		string line;
+		while (getline(file, line)) {
+			if (!line.empty() && line[0] != '#' && line.compare(0, host.size() + 1, host + " ") != 0) {
+				lines.push_back(line);
+			}
+		}
+	}
+	ofstream file(fileName);
+	if (!file) {
+		return false;
+	}
+	file << "# host/cpus ball-range chunks-per-thread grain threads mean-ms\n";
+	for (const string& line : lines) {
+		file << line << '\n';
+	}
+	for (const auto& [range, entry] : m_best) {
+		file << host << ' ' << range << ' ' << entry.m_settings.m_chunksPerThread << ' ' << entry.m_settings.m_grain
+			<< ' ' << entry.m_settings.m_threads << ' ' << entry.m_time << '\n';
+	}
+	return static_cast<bool>(file);
+}
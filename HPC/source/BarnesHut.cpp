@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <cmath>
+#include "BarnesHut.h"
+#include "ParallelAlgorithms.h"
+
+using namespace std;
+
+/**
+* Gets the centre of one of the 8 octants of a cell.
+* @param centre The centre of the cell.
+* @param size   The edge length of the cell.
+* @param octant The octant (bit 0 = +x, bit 1 = +y, bit 2 = +z).
+* @return The octant centre.
+*/
+static Vector3 octantCentre(const Vector3& centre, float size, uint32_t octant)
+{
+	const float q = size * 0.25f;
+	return centre + Vector3((octant & 1) ? q : -q, (octant & 2) ? q : -q, (octant & 4) ? q : -q);
+}
+
+/**
+* Gets the octant of a cell a position lies in.
+* @param centre   The centre of the cell.
+* @param position The position.
+* @return The octant (bit 0 = +x, bit 1 = +y, bit 2 = +z).
+*/
+static uint32_t octantOf(const Vector3& centre, const Vector3& position)
+{
+	return static_cast<uint32_t>(centre.lessThan(position).mask3());
+}
+
+BarnesHut::BarnesHut(ThreadPool& pool)
+	: m_pool(pool)
+{
+}
+
+void BarnesHut::setOpeningAngle(const float theta)
+{
+	m_theta = theta;
+}
+
+float BarnesHut::getOpeningAngle() const
+{
+	return m_theta;
+}
+
+void BarnesHut::setStrength(const float strength)
+{
+	m_strength = strength;
+}
+
+void BarnesHut::addAttractor(const Vector3& position, const float mass)
+{
+	Vector3 attractor = position;
+	attractor.setR(Vector3(mass));
+	m_attractors.push_back(attractor);
+}
+
+void BarnesHut::clearAttractors()
+{
+	m_attractors.clear();
+}
+
+size_t BarnesHut::nodeCount() const
+{
+	return m_nodes.size();
+}
+
+BarnesHut::Node BarnesHut::combine(const vector<Node>& nodes, const uint32_t first, const uint32_t count,
+	const float size)
+{
+	Vector3 sum = Vector3(0);
+	float total = 0.0f;
+	for (uint32_t i = first; i < first + count; i++) {
+		Vector3 mass = nodes[i].m_mass;
+		const float m = mass.getR().getX();
+		sum += mass * m;
+		total += m;
+	}
+	Node node;
+	node.m_mass = (total > 0.0f) ? sum / total : Vector3(0);
+	node.m_mass.setR(Vector3(total));
+	node.m_size = size;
+	node.m_first = first;
+	node.m_count = count;
+	node.m_leaf = false;
+	return node;
+}
+
+void BarnesHut::buildNode(vector<Node>& nodes, const uint32_t slot, const uint32_t begin, const uint32_t end,
+	const Vector3& centre, const float size, const uint32_t depth)
+{
+	if (end - begin <= s_leafSize || depth == 0) {
+		Vector3 sum = Vector3(0);
+		float total = 0.0f;
+		for (uint32_t i = begin; i < end; i++) {
+			Vector3 position = m_positions[m_order[i]];
+			const float m = 2.0f * position.getR().getX();
+			sum += position * m;
+			total += m;
+		}
+		Node& node = nodes[slot];
+		node.m_mass = (total > 0.0f) ? sum / total : centre;
+		node.m_mass.setR(Vector3(total));
+		node.m_size = size;
+		node.m_first = begin;
+		node.m_count = end - begin;
+		node.m_leaf = true;
+		return;
+	}
+
+	//8 way partition of the balls by octant, one axis at a time
+	uint32_t bounds[9];
+	bounds[0] = begin;
+	bounds[8] = end;
+	auto split = [&](uint32_t from, uint32_t to, uint32_t bit) {
+		return static_cast<uint32_t>(partition(m_order.begin() + from, m_order.begin() + to, [&](uint32_t ball) {
+			return (octantOf(centre, m_positions[ball]) & bit) == 0;
+		}) - m_order.begin());
+	};
+	bounds[4] = split(begin, end, 4);
+	bounds[2] = split(bounds[0], bounds[4], 2);
+	bounds[6] = split(bounds[4], bounds[8], 2);
+	for (uint32_t i = 0; i < 8; i += 2) {
+		bounds[i + 1] = split(bounds[i], bounds[i + 2], 1);
+	}
+
+	//the children of a node are stored contiguously, their own children are appended after them
+	uint32_t count = 0;
+	for (uint32_t octant = 0; octant < 8; octant++) {
+		count += (bounds[octant] != bounds[octant + 1]) ? 1 : 0;
+	}
+	const uint32_t first = static_cast<uint32_t>(nodes.size());
+	nodes.resize(first + count);
+	uint32_t child = first;
+	for (uint32_t octant = 0; octant < 8; octant++) {
+		if (bounds[octant] != bounds[octant + 1]) {
+			buildNode(nodes, child++, bounds[octant], bounds[octant + 1], octantCentre(centre, size, octant),
+				size * 0.5f, depth - 1);
+		}
+	}
+	nodes[slot] = combine(nodes, first, count, size);
+}
+
+void BarnesHut::build(const Vector3* positions, const uint32_t count)
+{
+	m_positions = positions;
+	m_nodes.clear();
+	if (count == 0) {
+		return;
+	}
+	const uint32_t chunks = static_cast<uint32_t>(max<size_t>(m_pool.size() * 2, 1));
+	const uint32_t numCells = s_gridSize * s_gridSize * s_gridSize;
+
+	//bounding cube of all the balls
+	FrameArena::Scope scope(m_pool.scratch());
+	ArenaVector<Vector3> lows(chunks, positions[0], ArenaAllocator<Vector3>(m_pool.scratch()));
+	ArenaVector<Vector3> highs(chunks, positions[0], ArenaAllocator<Vector3>(m_pool.scratch()));
+	parallelChunks(m_pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+		for (uint32_t i = start; i < end; i++) {
+			lows[chunk] = lows[chunk].min(positions[i]);
+			highs[chunk] = highs[chunk].max(positions[i]);
+		}
+	});
+	Vector3 low = lows[0];
+	Vector3 high = highs[0];
+	for (uint32_t i = 1; i < chunks; i++) {
+		low = low.min(lows[i]);
+		high = high.max(highs[i]);
+	}
+	const Vector3 centre = (low + high) * 0.5f;
+	const float size = (high - low).maxComponent3() + 0.001f;
+
+	//bucket the balls into the 64 cells of the top two levels (cell = level 1 octant * 8 + level 2 octant)
+	m_order.resize(count);
+	m_cellOf.resize(count);
+	m_counts.resize(chunks);
+	parallelChunks(m_pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+		vector<uint32_t>& counts = m_counts[chunk];
+		counts.assign(numCells, 0);
+		for (uint32_t i = start; i < end; i++) {
+			const uint32_t octant = octantOf(centre, positions[i]);
+			const uint32_t cell = (octant * 8) + octantOf(octantCentre(centre, size, octant), positions[i]);
+			m_cellOf[i] = cell;
+			++counts[cell];
+		}
+	});
+	uint32_t cellStart[numCells + 1];
+	uint32_t offset = 0;
+	for (uint32_t cell = 0; cell < numCells; cell++) {
+		cellStart[cell] = offset;
+		for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+			const uint32_t c = m_counts[chunk][cell];
+			m_counts[chunk][cell] = offset;
+			offset += c;
+		}
+	}
+	cellStart[numCells] = offset;
+	parallelChunks(m_pool, count, chunks, [&](uint32_t chunk, uint32_t start, uint32_t end) {
+		vector<uint32_t>& offsets = m_counts[chunk];
+		for (uint32_t i = start; i < end; i++) {
+			m_order[offsets[m_cellOf[i]]++] = i;
+		}
+	});
+
+	//each cell is an independent subtree
+	m_cellNodes.resize(numCells);
+	parallelChunks(m_pool, numCells, numCells, [&](uint32_t cell, uint32_t, uint32_t) {
+		vector<Node>& nodes = m_cellNodes[cell];
+		nodes.clear();
+		if (cellStart[cell] == cellStart[cell + 1]) {
+			return;
+		}
+		const uint32_t octant = cell / 8;
+		const Vector3 cellCentre = octantCentre(octantCentre(centre, size, octant), size * 0.5f, cell % 8);
+		nodes.resize(1);
+		buildNode(nodes, 0, cellStart[cell], cellStart[cell + 1], cellCentre, size * 0.25f, 16);
+	});
+
+	//layout: root, non-empty level 1 nodes, the cell roots of each level 1 node, then the rest of each cell
+	uint32_t level1[8];
+	uint32_t numLevel1 = 0;
+	for (uint32_t octant = 0; octant < 8; octant++) {
+		for (uint32_t cell = octant * 8; cell < (octant + 1) * 8; cell++) {
+			if (!m_cellNodes[cell].empty()) {
+				level1[numLevel1++] = octant;
+				break;
+			}
+		}
+	}
+	uint32_t cellRoot[numCells];
+	uint32_t next = 1 + numLevel1;
+	for (uint32_t i = 0; i < numLevel1; i++) {
+		for (uint32_t cell = level1[i] * 8; cell < (level1[i] + 1) * 8; cell++) {
+			cellRoot[cell] = m_cellNodes[cell].empty() ? 0 : next++;
+		}
+	}
+	uint32_t cellBody[numCells];
+	for (uint32_t cell = 0; cell < numCells; cell++) {
+		cellBody[cell] = next;
+		next += m_cellNodes[cell].empty() ? 0 : static_cast<uint32_t>(m_cellNodes[cell].size() - 1);
+	}
+	m_nodes.resize(next);
+	parallelChunks(m_pool, numCells, numCells, [&](uint32_t cell, uint32_t, uint32_t) {
+		const vector<Node>& nodes = m_cellNodes[cell];
+		if (nodes.empty()) {
+			return;
+		}
+		//cell nodes 1..n move to cellBody, so internal child indices shift by cellBody - 1
+		const uint32_t shift = cellBody[cell] - 1;
+		for (uint32_t i = 0; i < nodes.size(); i++) {
+			Node node = nodes[i];
+			if (!node.m_leaf) {
+				node.m_first += shift;
+			}
+			m_nodes[(i == 0) ? cellRoot[cell] : shift + i] = node;
+		}
+	});
+	next = 1 + numLevel1;
+	for (uint32_t i = 0; i < numLevel1; i++) {
+		uint32_t numCellsUsed = 0;
+		for (uint32_t cell = level1[i] * 8; cell < (level1[i] + 1) * 8; cell++) {
+			numCellsUsed += m_cellNodes[cell].empty() ? 0 : 1;
+		}
+		m_nodes[1 + i] = combine(m_nodes, next, numCellsUsed, size * 0.5f);
+		next += numCellsUsed;
+	}
+	m_nodes[0] = combine(m_nodes, 1, numLevel1, size);
+}
+
+void BarnesHut::accelerate(const Vector3* positions, const uint32_t start, const uint32_t end,
+	Vector3* accelerations) const
+{
+	const float theta2 = m_theta * m_theta;
+	uint32_t stack[256];
+
+	for (uint32_t current = start; current < end; current++)
+	{
+		Vector3 pointp = positions[current];
+		Vector3 accleration = Vector3(0);
+		//attraction of a point mass (mass in the 4th element) softened to avoid a singularity
+		auto attract = [&](Vector3 mass) {
+			Vector3 d = mass - pointp;
+			const float length2 = d.dot3(d).getX() + m_softening;
+			accleration += d * (mass.getR().getX() / (length2 * sqrtf(length2)));
+		};
+
+		uint32_t top = 0;
+		if (!m_nodes.empty()) {
+			stack[top++] = 0;
+		}
+		while (top > 0) {
+			const Node& node = m_nodes[stack[--top]];
+			if (node.m_leaf) {
+				for (uint32_t i = node.m_first; i < node.m_first + node.m_count; i++) {
+					const uint32_t current2 = m_order[i];
+					if (current2 != current)
+					{
+						Vector3 pointp2 = positions[current2];
+						pointp2.setR(pointp2.getR() * 2.0f);
+						attract(pointp2);
+					}
+				}
+				continue;
+			}
+			Vector3 d = node.m_mass - pointp;
+			if ((node.m_size * node.m_size) < (theta2 * d.dot3(d).getX())) {
+				//far enough away to be treated as a single mass
+				attract(node.m_mass);
+				continue;
+			}
+			for (uint32_t i = node.m_first; i < node.m_first + node.m_count; i++) {
+				stack[top++] = i;
+			}
+		}
+		for (const Vector3& attractor : m_attractors) {
+			attract(attractor);
+		}
+
+		accleration = accleration * m_strength;
+		accleration.setR(Vector3(0));
+		accelerations[current] = accleration;
+	}
+}
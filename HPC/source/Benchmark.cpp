@@ -0,0 +1,572 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <immintrin.h>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+#include "Benchmark.h"
+#include "BarnesHut.h"
+#include "CoTask.h"
+#include "CpuTopology.h"
+#include "EventCount.h"
+#include "HPCEngine.h"
+#include "MpmcQueue.h"
+#include "ParallelAlgorithms.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+using clock_type = conditional<chrono::high_resolution_clock::is_steady, chrono::high_resolution_clock,
+	chrono::steady_clock>::type;
+
+/**
+* Gets the time in milliseconds since a start point.
+* @param start The start point.
+* @return Elapsed milliseconds.
+*/
+static double millisecondsSince(const clock_type::time_point& start)
+{
+	return chrono::duration<double, milli>(clock_type::now() - start).count();
+}
+
+/**
+* Fills a set of balls with random positions inside the simulation box.
+* @param count The number of balls.
+* @param seed  The random seed.
+* @return The ball positions.
+*/
+static vector<Vector3> randomBalls(uint32_t count, uint32_t seed)
+{
+	mt19937 random(seed);
+	uniform_real_distribution<float> position(-38.0f, 38.0f);
+	const float radii[] = { 0.5f, 1.0f, 1.5f };
+	vector<Vector3> balls;
+	balls.reserve(count);
+	for (uint32_t i = 0; i < count; i++) {
+		balls.push_back(Vector3(position(random), position(random), position(random), radii[i % 3]));
+	}
+	return balls;
+}
+
+/** An item passed through the queue benchmarks. */
+struct QueueItem
+{
+	clock_type::time_point m_pushed; /**< When the producer pushed the item */
+	uint32_t m_index;                /**< The item number, summed to check every item arrived once */
+};
+
+/** The pool's queue: lock free ring, consumers spin briefly then sleep on an eventcount. */
+struct LockFreeQueue
+{
+	MpmcQueue<QueueItem> m_queue;
+	EventCount m_wake;
+	atomic<bool> m_closed = false;
+
+	void push(QueueItem* item)
+	{
+		while (!m_queue.push(item)) {
+			this_thread::yield();
+		}
+		m_wake.notifyOne();
+	}
+
+	QueueItem* pop()
+	{
+		while (true) {
+			for (uint32_t spin = 0; spin < ThreadPool::s_spinCount; spin++) {
+				if (QueueItem* item = m_queue.pop()) {
+					return item;
+				}
+				_mm_pause();
+			}
+			const uint32_t key = m_wake.prepareWait();
+			QueueItem* item = m_queue.pop();
+			if (item != nullptr || m_closed.load()) {
+				m_wake.cancelWait();
+				return item;
+			}
+			m_wake.wait(key);
+		}
+	}
+
+	void close()
+	{
+		m_closed = true;
+		m_wake.notifyAll();
+	}
+};
+
+/** The pool's previous queue: std::queue behind a mutex, every push notifies a condition variable. */
+struct MutexQueue
+{
+	queue<QueueItem*> m_queue;
+	mutex m_mutex;
+	condition_variable m_conditionVar;
+	bool m_closed = false;
+
+	void push(QueueItem* item)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_queue.push(item);
+		m_conditionVar.notify_one();
+	}
+
+	QueueItem* pop()
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_conditionVar.wait(lock, [this] { return m_closed || !m_queue.empty(); });
+		if (m_queue.empty()) {
+			return nullptr;
+		}
+		QueueItem* item = m_queue.front();
+		m_queue.pop();
+		return item;
+	}
+
+	void close()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_closed = true;
+		m_conditionVar.notify_all();
+	}
+};
+
+/**
+* Passes every item from a set of producer threads to a set of consumer threads.
+* @param queue     The queue to pass the items through.
+* @param producers The number of producer threads.
+* @param consumers The number of consumer threads.
+* @param items     The items, split evenly between the producers.
+* @param latency   Set to the mean time from push to pop in microseconds.
+* @param checksum  Set to the sum of the received item numbers.
+* @return The elapsed milliseconds.
+*/
+template<class Queue>
+static double passItems(Queue& queue, uint32_t producers, uint32_t consumers, vector<QueueItem>& items,
+	double& latency, uint64_t& checksum)
+{
+	atomic<int64_t> waited = 0;
+	atomic<uint64_t> sum = 0;
+	const auto start = clock_type::now();
+	vector<thread> threads;
+	for (uint32_t i = 0; i < consumers; i++) {
+		threads.emplace_back([&]() {
+			int64_t localWaited = 0;
+			uint64_t localSum = 0;
+			while (QueueItem* item = queue.pop()) {
+				localWaited += (clock_type::now() - item->m_pushed).count();
+				localSum += item->m_index;
+			}
+			waited.fetch_add(localWaited);
+			sum.fetch_add(localSum);
+		});
+	}
+	const size_t count = items.size();
+	for (uint32_t i = 0; i < producers; i++) {
+		threads.emplace_back([&, i]() {
+			for (size_t j = count * i / producers; j < count * (i + 1) / producers; j++) {
+				items[j].m_pushed = clock_type::now();
+				queue.push(&items[j]);
+			}
+		});
+	}
+	for (uint32_t i = consumers; i < threads.size(); i++) {
+		threads[i].join();
+	}
+	queue.close();
+	for (uint32_t i = 0; i < consumers; i++) {
+		threads[i].join();
+	}
+	const double time = millisecondsSince(start);
+	latency = chrono::duration<double, micro>(clock_type::duration(waited.load())).count() / count;
+	checksum = sum.load();
+	return time;
+}
+
+void Benchmark::report(const string& line)
+{
+	HPCEngine::logMessage(line + "\n");
+}
+
+bool Benchmark::run()
+{
+	report("HPC benchmarks");
+	bool passed = true;
+	passed &= dispatch();
+	passed &= coroutines();
+	passed &= queue();
+	passed &= affinity();
+	passed &= algorithms();
+	passed &= barnesHut();
+	report(passed ? "All benchmarks passed" : "Some benchmarks failed");
+	return passed;
+}
+
+bool Benchmark::barnesHut()
+{
+	ThreadPool pool;
+	BarnesHut tree(pool);
+	bool passed = true;
+	char buffer[160];
+	snprintf(buffer, sizeof(buffer), "BarnesHut (theta %.2f, %u threads): balls, nodes, build ms, force ms, max error",
+		tree.getOpeningAngle(), static_cast<uint32_t>(pool.size()));
+	report(buffer);
+
+	for (uint32_t count = 1000; count <= 1000000; count *= 10) {
+		const vector<Vector3> balls = randomBalls(count, count);
+		vector<Vector3> accelerations(count);
+
+		auto start = clock_type::now();
+		tree.build(balls.data(), count);
+		const double build = millisecondsSince(start);
+
+		start = clock_type::now();
+		const uint32_t chunks = static_cast<uint32_t>(pool.size() * 2);
+		const uint32_t numItems = (count + chunks - 1) / chunks;
+		vector<future<void>> waits;
+		for (uint32_t i = 0; i < chunks; i++) {
+			const uint32_t first = min(i * numItems, count);
+			waits.emplace_back(pool.enqueue([&, first]() {
+				tree.accelerate(balls.data(), first, min(first + numItems, count), accelerations.data());
+			}));
+		}
+		for (auto& w : waits) {
+			w.get();
+		}
+		const double force = millisecondsSince(start);
+
+		//compare a sample of balls against the exact result (opening angle of 0)
+		const float theta = tree.getOpeningAngle();
+		tree.setOpeningAngle(0.0f);
+		float maxError = 0.0f;
+		const uint32_t step = max(count / 64, 1U);
+		vector<Vector3> exact(count);
+		for (uint32_t i = 0; i < count; i += step) {
+			tree.accelerate(balls.data(), i, i + 1, exact.data());
+			const float error = (accelerations[i] - exact[i]).length().getX() / exact[i].length().getX();
+			maxError = max(maxError, error);
+		}
+		tree.setOpeningAngle(theta);
+		passed &= maxError < 0.05f;
+
+		snprintf(buffer, sizeof(buffer), "%u, %u, %.3f, %.3f, %.4f", count, static_cast<uint32_t>(tree.nodeCount()),
+			build, force, maxError);
+		report(buffer);
+	}
+	return passed;
+}
+
+bool Benchmark::dispatch()
+{
+	ThreadPool pool;
+	const uint32_t chunks = static_cast<uint32_t>(pool.size() * 2);
+	const uint32_t calls = 10000;
+	char buffer[160];
+	snprintf(buffer, sizeof(buffer), "Dispatch latency (%u threads, %u chunks): method, calls, mean us",
+		static_cast<uint32_t>(pool.size()), chunks);
+	report(buffer);
+
+	atomic<uint32_t> runs = 0;
+	auto start = clock_type::now();
+	for (uint32_t call = 0; call < calls; call++) {
+		vector<future<void>> waits;
+		for (uint32_t i = 0; i < chunks; i++) {
+			waits.emplace_back(pool.enqueue([&runs]() { runs.fetch_add(1, memory_order_relaxed); }));
+		}
+		for (auto& w : waits) {
+			w.get();
+		}
+	}
+	snprintf(buffer, sizeof(buffer), "futures, %u, %.3f", calls, millisecondsSince(start) * 1000.0 / calls);
+	report(buffer);
+
+	start = clock_type::now();
+	for (uint32_t call = 0; call < calls; call++) {
+		Latch latch;
+		for (uint32_t i = 0; i < chunks; i++) {
+			pool.enqueue(latch, [&runs]() { runs.fetch_add(1, memory_order_relaxed); });
+		}
+		pool.wait(latch);
+	}
+	snprintf(buffer, sizeof(buffer), "latch, %u, %.3f", calls, millisecondsSince(start) * 1000.0 / calls);
+	report(buffer);
+
+	start = clock_type::now();
+	for (uint32_t call = 0; call < calls; call++) {
+		pool.parallel_for(0, chunks, 1, [&runs](uint32_t first, uint32_t last) {
+			runs.fetch_add(last - first, memory_order_relaxed);
+		});
+	}
+	snprintf(buffer, sizeof(buffer), "parallel_for, %u, %.3f", calls, millisecondsSince(start) * 1000.0 / calls);
+	report(buffer);
+	return runs.load() == 3 * calls * chunks;
+}
+
+/**
+* A chunk of the coroutine benchmark frame.
+* @param pool  The pool the chunk runs on.
+* @param runs  Counts the chunks run.
+* @return The task.
+*/
+static CoTask<uint32_t> coroutineChunk(ThreadPool& pool, atomic<uint32_t>& runs)
+{
+	co_await schedule_on(pool);
+	co_return runs.fetch_add(1, memory_order_relaxed) & 1;
+}
+
+/**
+* A frame of the coroutine benchmark: chunks in two stages, the second starting once the first has
+* completed, written as sequential code.
+* @param pool   The pool the frame runs on.
+* @param chunks The number of chunks in each stage.
+* @param runs   Counts the chunks run.
+* @return The task.
+*/
+static CoTask<uint32_t> coroutineFrame(ThreadPool& pool, uint32_t chunks, atomic<uint32_t>& runs)
+{
+	uint32_t odd = 0;
+	for (uint32_t stage = 0; stage < 2; stage++) {
+		vector<CoTask<uint32_t>> tasks;
+		for (uint32_t i = 0; i < chunks; i++) {
+			tasks.push_back(coroutineChunk(pool, runs));
+		}
+		for (uint32_t result : co_await when_all(pool, move(tasks), false)) {
+			odd += result;
+		}
+	}
+	co_return odd;
+}
+
+bool Benchmark::coroutines()
+{
+	ThreadPool pool;
+	const uint32_t chunks = static_cast<uint32_t>(pool.size() * 2);
+	const uint32_t calls = 10000;
+	char buffer[160];
+	snprintf(buffer, sizeof(buffer), "Two stage frame (%u threads, %u chunks per stage): method, calls, mean us",
+		static_cast<uint32_t>(pool.size()), chunks);
+	report(buffer);
+
+	atomic<uint32_t> runs = 0;
+	auto start = clock_type::now();
+	for (uint32_t call = 0; call < calls; call++) {
+		for (uint32_t stage = 0; stage < 2; stage++) {
+			Latch latch;
+			for (uint32_t i = 0; i < chunks; i++) {
+				pool.enqueue(latch, [&runs]() { runs.fetch_add(1, memory_order_relaxed); });
+			}
+			pool.wait(latch);
+		}
+	}
+	snprintf(buffer, sizeof(buffer), "latch, %u, %.3f", calls, millisecondsSince(start) * 1000.0 / calls);
+	report(buffer);
+
+	uint32_t odd = 0;
+	start = clock_type::now();
+	for (uint32_t call = 0; call < calls; call++) {
+		odd += sync_wait(pool, coroutineFrame(pool, chunks, runs));
+	}
+	snprintf(buffer, sizeof(buffer), "coroutines, %u, %.3f", calls, millisecondsSince(start) * 1000.0 / calls);
+	report(buffer);
+	//the coroutine chunks saw every count from 2 * calls * chunks up exactly once, half of them odd
+	return runs.load() == 4 * calls * chunks && odd == calls * chunks;
+}
+
+bool Benchmark::queue()
+{
+	const uint32_t consumers = max(thread::hardware_concurrency(), 1U);
+	const uint32_t count = 1 << 18;
+	char buffer[160];
+	snprintf(buffer, sizeof(buffer), "Queue (%u consumers, %u items): queue, producers, items per ms, mean latency us",
+		consumers, count);
+	report(buffer);
+
+	vector<QueueItem> items(count);
+	for (uint32_t i = 0; i < count; i++) {
+		items[i].m_index = i;
+	}
+	const uint64_t expected = static_cast<uint64_t>(count) * (count - 1) / 2;
+	bool passed = true;
+	for (uint32_t producers = 1; producers <= 64; producers *= 2) {
+		double latency;
+		uint64_t checksum;
+		{
+			LockFreeQueue queue;
+			const double time = passItems(queue, producers, consumers, items, latency, checksum);
+			passed &= checksum == expected;
+			snprintf(buffer, sizeof(buffer), "lock free, %u, %.1f, %.3f", producers, count / time, latency);
+			report(buffer);
+		}
+		{
+			MutexQueue queue;
+			const double time = passItems(queue, producers, consumers, items, latency, checksum);
+			passed &= checksum == expected;
+			snprintf(buffer, sizeof(buffer), "mutex, %u, %.1f, %.3f", producers, count / time, latency);
+			report(buffer);
+		}
+	}
+	return passed;
+}
+
+bool Benchmark::affinity()
+{
+	const CpuTopology topology = CpuTopology::detect();
+	char buffer[160];
+	snprintf(buffer, sizeof(buffer), "Affinity (%u cpus, %u cores, %u packages): policy, reserved, threads, mean ms",
+		static_cast<uint32_t>(topology.cpus().size()), topology.coreCount(), topology.packageCount());
+	report(buffer);
+
+	//all pairs contact count, the same access pattern as the force solver
+	const uint32_t count = 4096;
+	const uint32_t repeats = 10;
+	const vector<Vector3> balls = randomBalls(count, 1);
+	vector<uint32_t> contacts(count);
+	const char* const names[] = { "none", "compact", "scatter", "physical cores" };
+	uint64_t expected = 0;
+	bool passed = true;
+	for (uint32_t policy = 0; policy < 4; policy++) {
+		for (uint32_t reserve = 0; reserve < 2; reserve++) {
+			{
+				ThreadPool pool(ThreadPool::Config{ 0, static_cast<ThreadPool::Affinity>(policy), reserve != 0 });
+				const auto start = clock_type::now();
+				for (uint32_t repeat = 0; repeat < repeats; repeat++) {
+					pool.parallel_for(0, count, 32, [&](uint32_t first, uint32_t last) {
+						for (uint32_t i = first; i < last; i++) {
+							Vector3 pointp = balls[i];
+							uint32_t found = 0;
+							for (uint32_t j = 0; j < count; j++) {
+								Vector3 pointp2 = balls[j];
+								found += ((pointp - pointp2).length() < (pointp.getR() + pointp2.getR())) ? 1 : 0;
+							}
+							contacts[i] = found;
+						}
+					});
+				}
+				const double time = millisecondsSince(start) / repeats;
+				uint64_t total = 0;
+				for (uint32_t found : contacts) {
+					total += found;
+				}
+				expected = (policy == 0 && reserve == 0) ? total : expected;
+				passed &= total == expected;
+				snprintf(buffer, sizeof(buffer), "%s, %s, %u, %.3f", names[policy], reserve ? "yes" : "no",
+					static_cast<uint32_t>(pool.size()), time);
+				report(buffer);
+			}
+			//the reserved core stays pinned to this thread so release it for the next pool
+			if (reserve != 0) {
+				CpuTopology::unpinCurrentThread();
+			}
+		}
+	}
+	return passed;
+}
+
+bool Benchmark::algorithms()
+{
+	const uint32_t count = 1 << 21;
+	char buffer[160];
+	snprintf(buffer, sizeof(buffer), "Parallel algorithms (%u items): threads, reduce ms, scan ms, radix sort 32 ms, "
+		"radix sort 64 ms, partition ms", count);
+	report(buffer);
+
+	//balls as an array of structures, keys as separate arrays. Keys repeat so the sorts must be stable,
+	// multiplying by an odd constant keeps the repeats while spreading them across every digit
+	const vector<Vector3> balls = randomBalls(count, 2);
+	mt19937_64 random(3);
+	vector<uint32_t> keys32(count);
+	vector<uint64_t> keys64(count);
+	vector<uint32_t> payload(count);
+	for (uint32_t i = 0; i < count; i++) {
+		keys32[i] = static_cast<uint32_t>(random() % (count / 8)) * 2654435761U;
+		keys64[i] = (random() % (count / 8)) * 0x9E3779B97F4A7C15ULL;
+		payload[i] = i;
+	}
+
+	//serial results
+	double expectedSum = 0.0;
+	for (Vector3 ball : balls) {
+		expectedSum += ball.getR().getX();
+	}
+	vector<uint32_t> expectedScan(count);
+	exclusive_scan(keys32.begin(), keys32.end(), expectedScan.begin(), 0U);
+	//the payload is each key's original index, so a stable sort of the indices gives both results
+	vector<uint32_t> order32 = payload;
+	stable_sort(order32.begin(), order32.end(), [&keys32](uint32_t a, uint32_t b) { return keys32[a] < keys32[b]; });
+	vector<uint32_t> order64 = payload;
+	stable_sort(order64.begin(), order64.end(), [&keys64](uint32_t a, uint32_t b) { return keys64[a] < keys64[b]; });
+	vector<uint32_t> sorted32(count);
+	vector<uint64_t> sorted64(count);
+	for (uint32_t i = 0; i < count; i++) {
+		sorted32[i] = keys32[order32[i]];
+		sorted64[i] = keys64[order64[i]];
+	}
+	vector<Vector3> expectedBalls = balls;
+	const auto above = [](const Vector3& ball) { return (ball.mask3() & 2) == 0; };
+	stable_partition(expectedBalls.begin(), expectedBalls.end(), above);
+
+	vector<uint32_t> scan(count);
+	vector<uint32_t> sortKeys32(count);
+	vector<uint64_t> sortKeys64(count);
+	vector<uint32_t> values(count);
+	vector<uint32_t> scratch32(count);
+	vector<uint64_t> scratch64(count);
+	vector<uint32_t> valueScratch(count);
+	vector<Vector3> partitioned(count);
+	bool passed = true;
+	//powers of 2 then one thread per cpu
+	vector<uint32_t> threadCounts;
+	const uint32_t cpus = max(thread::hardware_concurrency(), 1U);
+	for (uint32_t threads = 1; threads < cpus; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(cpus);
+	for (uint32_t threads : threadCounts) {
+		ThreadPool pool(ThreadPool::Config{ threads });
+
+		auto start = clock_type::now();
+		const double sum = parallel_reduce(pool, count, 0.0, [&balls](uint32_t i) {
+			Vector3 ball = balls[i];
+			return static_cast<double>(ball.getR().getX());
+		}, plus<double>());
+		const double reduce = millisecondsSince(start);
+		passed &= abs(sum - expectedSum) < 1e-6 * expectedSum;
+
+		start = clock_type::now();
+		parallel_scan(pool, keys32.data(), scan.data(), count, 0U, plus<uint32_t>(), false);
+		const double scanTime = millisecondsSince(start);
+		passed &= scan == expectedScan;
+
+		sortKeys32 = keys32;
+		values = payload;
+		start = clock_type::now();
+		parallel_radix_sort(pool, sortKeys32.data(), values.data(), count, scratch32.data(), valueScratch.data());
+		const double sort32 = millisecondsSince(start);
+		passed &= sortKeys32 == sorted32 && values == order32;
+
+		sortKeys64 = keys64;
+		values = payload;
+		start = clock_type::now();
+		parallel_radix_sort(pool, sortKeys64.data(), values.data(), count, scratch64.data(), valueScratch.data());
+		const double sort64 = millisecondsSince(start);
+		passed &= sortKeys64 == sorted64 && values == order64;
+
+		start = clock_type::now();
+		parallel_partition(pool, balls.data(), partitioned.data(), count, above);
+		const double partition = millisecondsSince(start);
+		passed &= memcmp(partitioned.data(), expectedBalls.data(), count * sizeof(Vector3)) == 0;
+
+		snprintf(buffer, sizeof(buffer), "%u, %.3f, %.3f, %.3f, %.3f, %.3f", static_cast<uint32_t>(pool.size()), reduce,
+			scanTime, sort32, sort64, partition);
+		report(buffer);
+	}
+	return passed;
+}
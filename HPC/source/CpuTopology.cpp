@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include "CpuTopology.h"
+#ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <Windows.h>
+#else
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
+using namespace std;
+
+#ifndef _WIN32
+/**
+* Reads a single number from a sysfs file.
+* @param path  The file path.
+* @param value Returned value.
+* @return True if successful.
+*/
+static bool readNumber(const string& path, uint32_t& value)
+{
+	ifstream file(path);
+	return static_cast<bool>(file >> value);
+}
+
+/**
+* Parses a sysfs cpu list such as "0-3,8-11".
+* @param list The list.
+* @return The cpu numbers.
+*/
+static vector<uint32_t> parseList(const string& list)
+{
+	vector<uint32_t> ids;
+	stringstream stream(list);
+	string range;
+	while (getline(stream, range, ',')) {
+		const size_t dash = range.find('-');
+		try {
+			const uint32_t first = stoul(range.substr(0, dash));
+			const uint32_t last = (dash == string::npos) ? first : stoul(range.substr(dash + 1));
+			for (uint32_t id = first; id <= last; id++) {
+				ids.push_back(id);
+			}
+		} catch (const exception&) {
+			//skip anything malformed
+		}
+	}
+	return ids;
+}
+#endif
+
+CpuTopology CpuTopology::detect()
+{
+	CpuTopology topology;
+#ifdef _WIN32
+	DWORD length = 0;
+	GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+	vector<char> buffer(length);
+	auto info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data());
+	if (length > 0 && GetLogicalProcessorInformationEx(RelationAll, info, &length)) {
+		map<uint32_t, Cpu> cpus;
+		uint32_t core = 0;
+		uint32_t package = 0;
+		for (DWORD offset = 0; offset < length; offset += info->Size) {
+			info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+			if (info->Relationship != RelationProcessorCore && info->Relationship != RelationProcessorPackage) {
+				continue;
+			}
+			//processor numbers are made unique across groups as group * 64 + bit
+			for (WORD group = 0; group < info->Processor.GroupCount; group++) {
+				const GROUP_AFFINITY& mask = info->Processor.GroupMask[group];
+				for (uint32_t bit = 0; bit < 64; bit++) {
+					if ((mask.Mask & (KAFFINITY(1) << bit)) != 0) {
+						Cpu& cpu = cpus[mask.Group * 64 + bit];
+						cpu.m_id = mask.Group * 64 + bit;
+						if (info->Relationship == RelationProcessorCore) {
+							cpu.m_core = core;
+						} else {
+							cpu.m_package = package;
+						}
+					}
+				}
+			}
+			if (info->Relationship == RelationProcessorCore) {
+				core++;
+			} else {
+				package++;
+			}
+		}
+		for (auto& cpu : cpus) {
+			topology.m_cpus.push_back(cpu.second);
+		}
+	}
+#else
+	const string root = "/sys/devices/system/cpu/";
+	ifstream online(root + "online");
+	string list;
+	if (getline(online, list)) {
+		//core ids are only unique within a package so are renumbered
+		map<pair<uint32_t, uint32_t>, uint32_t> cores;
+		for (uint32_t id : parseList(list)) {
+			const string path = root + "cpu" + to_string(id) + "/topology/";
+			uint32_t core = id;
+			uint32_t package = 0;
+			readNumber(path + "core_id", core);
+			readNumber(path + "physical_package_id", package);
+			auto found = cores.emplace(make_pair(package, core), static_cast<uint32_t>(cores.size())).first;
+			topology.m_cpus.push_back(Cpu{ id, found->second, package });
+		}
+	}
+#endif
+	if (topology.m_cpus.empty()) {
+		const uint32_t count = max(thread::hardware_concurrency(), 1U);
+		for (uint32_t id = 0; id < count; id++) {
+			topology.m_cpus.push_back(Cpu{ id, id, 0 });
+		}
+	}
+	return topology;
+}
+
+const vector<CpuTopology::Cpu>& CpuTopology::cpus() const
+{
+	return m_cpus;
+}
+
+uint32_t CpuTopology::coreCount() const
+{
+	uint32_t count = 0;
+	for (const auto& cpu : m_cpus) {
+		count = max(count, cpu.m_core + 1);
+	}
+	return count;
+}
+
+uint32_t CpuTopology::packageCount() const
+{
+	uint32_t count = 0;
+	for (const auto& cpu : m_cpus) {
+		count = max(count, cpu.m_package + 1);
+	}
+	return count;
+}
+
+vector<CpuTopology::Cpu> CpuTopology::order(const Affinity affinity, const uint32_t excludeCore) const
+{
+	if (affinity == Affinity::None) {
+		return {};
+	}
+	//rank each cpu by its sibling number within its core and its core number within its package
+	struct Ranked
+	{
+		Cpu m_cpu;
+		uint32_t m_sibling;
+		uint32_t m_core;
+	};
+	vector<Ranked> ranked;
+	map<uint32_t, uint32_t> siblings;
+	map<uint32_t, uint32_t> corePosition;
+	map<uint32_t, uint32_t> packageCores;
+	for (const auto& cpu : m_cpus) {
+		if (cpu.m_core == excludeCore) {
+			continue;
+		}
+		if (corePosition.find(cpu.m_core) == corePosition.end()) {
+			corePosition[cpu.m_core] = packageCores[cpu.m_package]++;
+		}
+		ranked.push_back(Ranked{ cpu, siblings[cpu.m_core]++, corePosition[cpu.m_core] });
+	}
+
+	if (affinity == Affinity::Compact) {
+		stable_sort(ranked.begin(), ranked.end(), [](const Ranked& a, const Ranked& b) {
+			return tie(a.m_cpu.m_package, a.m_core, a.m_sibling) < tie(b.m_cpu.m_package, b.m_core, b.m_sibling);
+		});
+	} else {
+		stable_sort(ranked.begin(), ranked.end(), [](const Ranked& a, const Ranked& b) {
+			return tie(a.m_sibling, a.m_core, a.m_cpu.m_package) < tie(b.m_sibling, b.m_core, b.m_cpu.m_package);
+		});
+	}
+	vector<Cpu> cpus;
+	for (const auto& rank : ranked) {
+		if (affinity != Affinity::PhysicalCores || rank.m_sibling == 0) {
+			cpus.push_back(rank.m_cpu);
+		}
+	}
+	return cpus;
+}
+
+bool CpuTopology::pin(thread::native_handle_type handle, const uint32_t cpu)
+{
+#ifdef _WIN32
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = static_cast<WORD>(cpu / 64);
+	affinity.Mask = KAFFINITY(1) << (cpu % 64);
+	return SetThreadGroupAffinity(static_cast<HANDLE>(handle), &affinity, nullptr) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#endif
+}
+
+bool CpuTopology::pin(thread::native_handle_type handle, const vector<uint32_t>& cpus)
+{
+	if (cpus.empty()) {
+		return false;
+	}
+#ifdef _WIN32
+	//a thread can only be given processors of a single group
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = static_cast<WORD>(cpus.front() / 64);
+	for (const uint32_t cpu : cpus) {
+		if (cpu / 64 == affinity.Group) {
+			affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+		}
+	}
+	return SetThreadGroupAffinity(static_cast<HANDLE>(handle), &affinity, nullptr) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (const uint32_t cpu : cpus) {
+		CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#endif
+}
+
+bool CpuTopology::pinCurrentThread(const uint32_t cpu)
+{
+#ifdef _WIN32
+	return pin(GetCurrentThread(), cpu);
+#else
+	return pin(pthread_self(), cpu);
+#endif
+}
+
+bool CpuTopology::unpinCurrentThread()
+{
+#ifdef _WIN32
+	DWORD_PTR process = 0;
+	DWORD_PTR system = 0;
+	return GetProcessAffinityMask(GetCurrentProcess(), &process, &system) != 0 &&
+		SetThreadAffinityMask(GetCurrentThread(), process) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (const auto& cpu : detect().cpus()) {
+		CPU_SET(cpu.m_id, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+uint32_t CpuTopology::currentCpu()
+{
+#ifdef _WIN32
+	PROCESSOR_NUMBER number;
+	GetCurrentProcessorNumberEx(&number);
+	return static_cast<uint32_t>(number.Group) * 64 + number.Number;
+#else
+	const int cpu = sched_getcpu();
+	return (cpu >= 0) ? static_cast<uint32_t>(cpu) : 0;
+#endif
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <new>
+#include "FrameArena.h"
+
+using namespace std;
+
+FrameArena::FrameArena(const size_t bytes)
+	: m_capacity(max<size_t>(bytes, s_alignment))
+{
+	m_buffer = static_cast<char*>(::operator new(m_capacity, align_val_t(s_alignment)));
+}
+
+FrameArena::~FrameArena()
+{
+	reset();
+	::operator delete(m_buffer, align_val_t(s_alignment));
+}
+
+void* FrameArena::allocate(const size_t bytes, const size_t alignment)
+{
+	size_t offset = m_offset.load(memory_order_relaxed);
+	size_t start;
+	do {
+		start = (offset + alignment - 1) & ~(alignment - 1);
+		if (start + bytes > m_capacity) {
+			return allocateOverflow(bytes);
+		}
+	} while (!m_offset.compare_exchange_weak(offset, start + bytes, memory_order_relaxed));
+	return m_buffer + start;
+}
+
+void* FrameArena::allocateOverflow(const size_t bytes)
+{
+	void* memory = ::operator new(max<size_t>(bytes, 1), align_val_t(s_alignment));
+	lock_guard<mutex> lock(m_overflowMutex);
+	m_overflow.push_back(memory);
+	m_overflowBytes += bytes;
+	return memory;
+}
+
+size_t FrameArena::mark() const
+{
+	return m_offset.load(memory_order_relaxed);
+}
+
+void FrameArena::rewind(const size_t mark)
+{
+	const size_t used = m_offset.load(memory_order_relaxed) + m_overflowBytes;
+	m_peak = max(m_peak, used);
+	m_offset.store(mark, memory_order_relaxed);
+	if (mark != 0 || m_overflow.empty()) {
+		return;
+	}
+	//the arena is empty so the buffer can be regrown to hold everything the heap had to
+	for (void* memory : m_overflow) {
+		::operator delete(memory, align_val_t(s_alignment));
+	}
+	m_overflow.clear();
+	m_overflowBytes = 0;
+	::operator delete(m_buffer, align_val_t(s_alignment));
+	//alignment padding between allocations is not counted, leave room for it
+	m_capacity = max(m_capacity * 2, m_peak + m_peak / 4);
+	m_buffer = static_cast<char*>(::operator new(m_capacity, align_val_t(s_alignment)));
+}
+
+void FrameArena::reset()
+{
+	rewind(0);
+}
+
+size_t FrameArena::getCapacity() const
+{
+	return m_capacity;
+}
+
+size_t FrameArena::getPeak() const
+{
+	return m_peak;
+}
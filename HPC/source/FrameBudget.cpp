@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdio>
+#include "FrameBudget.h"
+#include "HPCEngine.h"
+
+using namespace std;
+
+/**
+* Gets the log name of a degradation.
+* @param degradation The degradation.
+* @return The name.
+*/
+static const char* degradationName(FrameBudget::Degradation degradation)
+{
+	switch (degradation) {
+	case FrameBudget::SkipSleeping:
+		return "sleeping balls";
+	case FrameBudget::CoarseSteps:
+		return "coarse steps";
+	default:
+		return "reduced render rate";
+	}
+}
+
+FrameBudget::FrameBudget(const float target, const uint32_t degradations)
+	: m_target(target)
+{
+	for (Degradation degradation : { SkipSleeping, CoarseSteps, ReducedRender }) {
+		if ((degradations & degradation) != 0) {
+			m_levels.push_back(degradation);
+		}
+	}
+}
+
+bool FrameBudget::update(const double stepTime, const uint32_t applicable)
+{
+	if (m_target <= 0.0f || m_levels.empty()) {
+		return false;
+	}
+	m_average = (m_average == 0.0) ? stepTime : m_average + (stepTime - m_average) * s_smoothing;
+	m_over = (m_average > m_target) ? m_over + 1 : 0;
+	m_under = (m_average < m_target * s_headroom) ? m_under + 1 : 0;
+	const uint32_t level = m_level.load(memory_order_relaxed);
+	if (m_over >= s_overSteps) {
+		for (uint32_t next = level; next < m_levels.size(); next++) {
+			if ((m_levels[next] & applicable) != 0) {
+				setLevel(next + 1, next, applicable);
+				return true;
+			}
+		}
+	}
+	if (m_under >= s_underSteps) {
+		for (uint32_t next = level; next > 0; next--) {
+			if ((m_levels[next - 1] & applicable) != 0) {
+				setLevel(next - 1, next - 1, applicable);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void FrameBudget::setLevel(const uint32_t level, const uint32_t changed, const uint32_t applicable)
+{
+	const uint32_t previous = m_level.load(memory_order_relaxed);
+	uint32_t active = 0;
+	for (uint32_t i = 0; i < level; i++) {
+		active |= m_levels[i];
+	}
+	active &= applicable;
+	m_active.store(active, memory_order_relaxed);
+	m_level.store(level, memory_order_relaxed);
+
+	char buffer[160];
+	snprintf(buffer, sizeof(buffer), "Frame budget: %.2f ms steps against %.2f ms, %s %s (level %u/%u)\n", m_average,
+		m_target, (level > previous) ? "applying" : "removing", degradationName(m_levels[changed]),
+		level, static_cast<uint32_t>(m_levels.size()));
+	HPCEngine::logMessage(buffer);
+
+	//the next change is judged only on steps run at the new level
+	m_average = 0.0;
+	m_over = 0;
+	m_under = 0;
+}
+
+bool FrameBudget::isActive(const Degradation degradation) const
+{
+	return (m_active.load(memory_order_relaxed) & degradation) != 0;
+}
+
+uint32_t FrameBudget::getLevel() const
+{
+	return m_level.load(memory_order_relaxed);
+}
+
+float FrameBudget::getTarget() const
+{
+	return m_target;
+}
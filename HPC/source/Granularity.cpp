@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "Granularity.h"
+#include "Vector3_SSE.h"
+
+using namespace std;
+
+using clock_type = chrono::steady_clock;
+
+/** Results of the timed loops are stored here before the clock is read, so they are not optimised away */
+static volatile float s_sink = 0.0f;
+
+/**
+* Gets the time in nanoseconds since a start point.
+* @param start The start point.
+* @return Elapsed nanoseconds.
+*/
+static double nanosecondsSince(const clock_type::time_point& start)
+{
+	return chrono::duration<double, nano>(clock_type::now() - start).count();
+}
+
+/**
+* Runs a pass repeatedly until at least a millisecond has passed, so the clock's resolution and
+* one off stalls do not dominate short passes.
+* @param pass The pass to time.
+* @return The mean time of a pass in nanoseconds.
+*/
+template<class F>
+static double timePass(F&& pass)
+{
+	const double minimumTime = 1000000.0;
+	uint32_t runs = 0;
+	double elapsed = 0.0;
+	const auto start = clock_type::now();
+	do {
+		pass();
+		runs++;
+		elapsed = nanosecondsSince(start);
+	} while (elapsed < minimumTime);
+	return elapsed / runs;
+}
+
+void Granularity::calibrate(ThreadPool& pool)
+{
+	m_maxParticipants = static_cast<uint32_t>(pool.size() + 1);
+
+	//an empty range with one item per thread, averaged as some runs wake the workers and some do not
+	const uint32_t repeats = 256;
+	const auto start = clock_type::now();
+	for (uint32_t i = 0; i < repeats; i++) {
+		pool.parallel_for(0, m_maxParticipants, 1, [](uint32_t, uint32_t) {});
+	}
+	m_dispatchCost = nanosecondsSince(start) / repeats;
+
+	//a grid of overlapping balls tested against each other as ballAcceleration does
+	const uint32_t count = 512;
+	vector<Vector3> balls;
+	vector<Vector3> velocities(count, Vector3(0.5f));
+	for (uint32_t i = 0; i < count; i++) {
+		balls.push_back(Vector3(static_cast<float>(i % 8), static_cast<float>((i / 8) % 8), static_cast<float>(i / 64),
+			1.0f));
+	}
+	const double pairTime = timePass([&balls, count]() {
+		uint32_t contacts = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			Vector3 pointp = balls[i];
+			Vector3 radius = pointp.getR();
+			for (uint32_t j = 0; j < count; j++) {
+				Vector3 pointp2 = balls[j];
+				contacts += ((pointp - pointp2).length() < (radius + pointp2.getR())) ? 1 : 0;
+			}
+		}
+		s_sink = static_cast<float>(contacts);
+	});
+	m_pairCost = max(pairTime / (static_cast<double>(count) * count), 0.01);
+
+	//a single update pass takes microseconds, so it is repeated over the same balls
+	const double updateTime = timePass([&balls, &velocities, count]() {
+		const float elapsedTime = 0.001f;
+		for (uint32_t i = 0; i < count; i++) {
+			Vector3 pointp = balls[i];
+			Vector3 radius = pointp.getR();
+			Vector3 newpos = pointp + ((velocities[i] + (Vector3(0.0f, -9.8f, 0.0f) * elapsedTime)) * elapsedTime);
+			newpos.setR(radius);
+			velocities[i] = (newpos - pointp) / elapsedTime;
+			balls[i] = newpos;
+		}
+		s_sink = balls[count - 1].getX() + velocities[count - 1].getX();
+	});
+	m_updateCost = max(updateTime / count, 0.01);
+}
+
+uint32_t Granularity::participants(const uint32_t items, const double itemCost) const
+{
+	const double work = items * itemCost;
+	const double threads = work / (m_dispatchCost * s_workPerThread);
+	return max(static_cast<uint32_t>(min(threads, static_cast<double>(min(m_maxParticipants, m_threadLimit)))), 1U);
+}
+
+void Granularity::setThreadLimit(const uint32_t limit)
+{
+	m_threadLimit = max(limit, 1U);
+}
+
+uint32_t Granularity::getMaxParticipants() const
+{
+	return m_maxParticipants;
+}
+
+double Granularity::getPairCost() const
+{
+	return m_pairCost;
+}
+
+double Granularity::getUpdateCost() const
+{
+	return m_updateCost;
+}
+
+double Granularity::getDispatchCost() const
+{
+	return m_dispatchCost;
+}
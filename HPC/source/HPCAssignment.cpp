@@ -1,160 +1,1023 @@
-/**
- * @file HPCAssignment.cpp
- *
- * @section LICENSE
- *
- * This code is not available for commercial use. This code is provided as is
- * and the author claims no responsibility for any issues, damages or any other
- * ill effects resulting from use of this code.
- *
- * @section DESCRIPTION
- *
- * This defines the base HPCAssignment class. This is provided to abstract some of the
- * more complex aspects of completing the HPC Assignment.
- */
-#include "HPCAssignment.h"
-#include "HPCEngine.h"
-#include <cstdint>
-#include <thread>
-using namespace std;
-
-void HPCAssignment::addBalls()
-{
-	//blue ballz
-		for (float x = -38.0f; x < 38.0f; x += 4.5f) {
-			for (float z = -38.0f; z < 38.0f; z += 4.0f) {
-				myballz.push_back(Vector3(x, 38.0f, z, 1.5f));
-				myvelocityz.push_back(Vector3(0.0f));
-			}
-		}
-	//green
-		for (float x = -38.0f; x < 38.5f; x += 4.5f) {
-			for (float z = -38.0f; z < 38.5f; z += 4.5f) {
-				myballz.push_back(Vector3(x, 35.3f, z, 1.0f));
-				myvelocityz.push_back(Vector3(0.0f));
-			}
-		}
-	//red
-
-		for (float x = -38.0f; x < 38.5f; x += 4.3f) {
-			for (float z = -38.0f; z < 38.5f; z += 3.5f) {
-				myballz.push_back(Vector3(x, 32.0f, z, 0.5f));
-				myvelocityz.push_back(Vector3(0.0f));
-			}
-		}
-	myballz2.reserve(myballz.size());
-	myballz2.resize(myballz.size());
-	myvelocityz2.reserve(myvelocityz.size());
-	myvelocityz2.resize(myvelocityz.size());
-}
-
-
-
-void HPCAssignment::doSomeBallStuff(uint32_t start, uint32_t end, const float elapsedTime, const Vector3* gravityVec)
-{
-	Vector3 kw = Vector3(-500);
-	Vector3 bw = Vector3(10);
-	Vector3 kb = Vector3(-300);
-	Vector3 bb = Vector3(5);
-
-	for (uint32_t current = start; current < end; current++)
-	{
-		
-			Vector3 pointp = myballz[current];
-			Vector3 radius = pointp.getR();
-			Vector3 pointv = myvelocityz[current];
-			//d = pa - pb ??????
-			Vector3 force = Vector3(0);
-
-			Vector3 four = Vector3(40.0);
-			Vector3 xp = (pointp + radius) - four;
-			Vector3 match = Vector3().lessThan(xp);//cmplt
-			Vector3 force2 = (((kw * xp) - (bw * pointv)));
-			force2 = force2 & match;
-			force += force2;
-
-			Vector3 xn = four + (pointp - radius);
-			Vector3 match2 = xn.lessThan(Vector3());
-			Vector3 force3 = (((kw * xn) - (bw * pointv)));
-			force3 = force3 & match2;
-			force += force3;
-
-			
-			for (uint32_t current2 = 0; current2 < myballz.size(); current2++) {
-
-				if (current != current2)
-				{
-					Vector3 pointp2 = myballz[current2];
-					Vector3 d = pointp - pointp2;
-					Vector3 length = d.length();
-					Vector3 radius2 = pointp2.getR();
-						if(length < (radius + radius2))
-						{
-							Vector3 pointv2 = myvelocityz[current2];
-							Vector3 nor = d / length;
-							Vector3 x = length - (radius + radius2);
-							Vector3 vs = (pointv - pointv2).dot3(nor);
-							//normalise = d / d.length
-
-							force += nor * ((kb * x) - (bb * vs));
-						}
-
-						
-				}
-			}
-
-			Vector3 accleration = (force / (radius + radius)) + *gravityVec;
-
-			Vector3 newpos = pointp + ((pointv + (accleration * elapsedTime)) * elapsedTime);
-			newpos.setR(radius);
-			myballz2[current] = newpos;
-			//calculate velocity
-			Vector3 newvelocity = (newpos - pointp) / elapsedTime;
-			myvelocityz2[current] = newvelocity;
-	}
-
-
-}
-
-bool HPCAssignment::load() noexcept
-{
-    /* Add required start up code here */
-	addBalls();
-    return true;
-}
-
-void HPCAssignment::run(const float elapsedTime, float* gravity, const bool addBall) noexcept
-{
-    /* Add required code here */
-    /* Note gravity can be converted to whatever Vector 3 type you are using through a simple cast
-       e.g. Vector3 gravityVec = *reinterpret_cast<Vector3*>(gravity);
-    */
-	Vector3 gravityVec = *reinterpret_cast<Vector3*>(gravity);
-	if (addBall == true) {
-		addBalls();
-	}
-	//thread pool of doSomeBallStuff
-	int numBalls = myballz.size() / (threads.size() * 2);
-	int numThreads = myballz.size() / numBalls;
-	vector<std::future<void>> waits;
-	for (int i = 0; i < numThreads-1; i++) {
-		waits.emplace_back(threads.enqueue(&HPCAssignment::doSomeBallStuff, this, i*numBalls, (i+1)*numBalls, elapsedTime, &gravityVec));
-	}
-	waits.emplace_back(threads.enqueue(&HPCAssignment::doSomeBallStuff, this, (numThreads - 1 )*numBalls, myballz.size(), elapsedTime, &gravityVec));
-
-	for (auto& w : waits) {
-		w.get();
-	}
-
-	std::swap(myballz, myballz2);
-	std::swap(myvelocityz, myvelocityz2);
-
-	HPCEngine::updateRenderData((HPCEngine::RenderData*)myballz.data(), myballz.size());
-}
-
-void HPCAssignment::unload() noexcept
-{
-    /* Add required shut down code here */
-}
-
-
+/**
+ * @file HPCAssignment.cpp
+ *
+ * @section LICENSE
+ *
+ * This code is not available for commercial use. This code is provided as is
+ * and the author claims no responsibility for any issues, damages or any other
+ * ill effects resulting from use of this code.
+ *
+ * @section DESCRIPTION
+ *
+ * This defines the base HPCAssignment class. This is provided to abstract some of the
+ * more complex aspects of completing the HPC Assignment.
+ */
+#include "HPCAssignment.h"
+#include "HPCEngine.h"
+#include "ParallelAlgorithms.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+using namespace std;
+
+/** Where removed balls are parked with no radius, too far from the box for any live ball to touch */
+static const float s_parked = 1.0e6f;
+
+void HPCAssignment::addBalls()
+{
+	//the wave is gathered first so the oldest balls can make room for all of it
+	vector<Vector3> wave;
+	//blue ballz
+		for (float x = -38.0f; x < 38.0f; x += 4.5f) {
+			for (float z = -38.0f; z < 38.0f; z += 4.0f) {
+				wave.push_back(Vector3(x, 38.0f, z, 1.5f));
+			}
+		}
+	//green
+		for (float x = -38.0f; x < 38.5f; x += 4.5f) {
+			for (float z = -38.0f; z < 38.5f; z += 4.5f) {
+				wave.push_back(Vector3(x, 35.3f, z, 1.0f));
+			}
+		}
+	//red
+
+		for (float x = -38.0f; x < 38.5f; x += 4.3f) {
+			for (float z = -38.0f; z < 38.5f; z += 3.5f) {
+				wave.push_back(Vector3(x, 32.0f, z, 0.5f));
+			}
+		}
+	removeOldest(static_cast<uint32_t>(wave.size()));
+	for (const Vector3& ball : wave) {
+		spawnBall(ball);
+	}
+	resizeBuffers();
+}
+
+void HPCAssignment::spawnBall(const Vector3& position)
+{
+	if (m_freeBalls.empty()) {
+		myballz.push_back(position);
+		myvelocityz.push_back(Vector3(0.0f));
+		m_spawnSerial.push_back(m_nextSerial++);
+		return;
+	}
+	//the live balls after a reused slot shift along in the render data
+	const uint32_t ball = m_freeBalls.back();
+	m_freeBalls.pop_back();
+	myballz[ball] = position;
+	myvelocityz[ball] = Vector3(0.0f);
+	m_spawnSerial[ball] = m_nextSerial++;
+	m_restSteps[ball] = 0;
+	m_ballCost[ball] = 0;
+	m_renderLayout++;
+}
+
+void HPCAssignment::removeBall(const uint32_t ball) noexcept
+{
+	if (ball >= myballz.size() || isRemoved(ball)) {
+		return;
+	}
+	//left in place until the balls are packed, every kernel skips it and it is out of reach of the pair loops
+	myballz[ball] = Vector3(s_parked, s_parked, s_parked, 0.0f);
+	myvelocityz[ball] = Vector3(0.0f);
+	m_restSteps[ball] = s_removed;
+	m_ballCost[ball] = 0;
+	m_freeBalls.push_back(ball);
+	m_renderLayout++;
+}
+
+uint32_t HPCAssignment::getLiveBalls() const noexcept
+{
+	return static_cast<uint32_t>(myballz.size() - m_freeBalls.size());
+}
+
+void HPCAssignment::removeEscaped()
+{
+	if (HPC_ESCAPE_DISTANCE <= 0.0f) {
+		return;
+	}
+	//a ball thrown through a wall never comes back, nor does one whose position is no longer a number
+	Vector3 high = Vector3(HPC_ESCAPE_DISTANCE);
+	Vector3 low = Vector3(-HPC_ESCAPE_DISTANCE);
+	forEachMatch([&](uint32_t current) {
+		Vector3 pointp = myballz[current];
+		return !isRemoved(current) && (pointp.lessThan(high) & low.lessThan(pointp)).mask3() != 7;
+	}, [this](uint32_t ball) {
+		removeBall(ball);
+	});
+}
+
+void HPCAssignment::removeOldest(const uint32_t incoming)
+{
+	const uint32_t live = getLiveBalls();
+	if (HPC_MAX_BALLS == 0 || live + incoming <= HPC_MAX_BALLS) {
+		return;
+	}
+	//serials are handed out in order so no more than the balls kept can be newer than this
+	const uint32_t kept = HPC_MAX_BALLS - min<uint32_t>(incoming, HPC_MAX_BALLS);
+	const uint32_t oldest = m_nextSerial - kept;
+	forEachMatch([&](uint32_t current) {
+		return !isRemoved(current) && m_spawnSerial[current] < oldest;
+	}, [this](uint32_t ball) {
+		removeBall(ball);
+	});
+}
+
+void HPCAssignment::compactBalls()
+{
+	//each live ball's packed index is the number of live balls before it, so the order is kept
+	const uint32_t size = static_cast<uint32_t>(myballz.size());
+	m_packedIndex.resize(size);
+	const uint32_t live = parallel_scan(threads, size, m_packedIndex.data(), 0u, [this](uint32_t i) {
+		return isRemoved(i) ? 0u : 1u;
+	}, plus<uint32_t>(), false);
+
+	//scatter into the second buffers (grown for the pass under the two pass integration)
+	myballz2.resize(size);
+	myvelocityz2.resize(size);
+	uint8_t* restSteps = m_frameArena.allocate<uint8_t>(live);
+	uint32_t* ballCost = m_frameArena.allocate<uint32_t>(live);
+	uint32_t* spawnSerial = m_frameArena.allocate<uint32_t>(live);
+	runChunks([&](uint32_t, uint32_t start, uint32_t end) {
+		for (uint32_t current = start; current < end; current++) {
+			if (!isRemoved(current)) {
+				const uint32_t packed = m_packedIndex[current];
+				myballz2[packed] = myballz[current];
+				myvelocityz2[packed] = myvelocityz[current];
+				restSteps[packed] = m_restSteps[current];
+				ballCost[packed] = m_ballCost[current];
+				spawnSerial[packed] = m_spawnSerial[current];
+			}
+		}
+	}, ballWork());
+	std::swap(myballz, myballz2);
+	std::swap(myvelocityz, myvelocityz2);
+	myballz.resize(live);
+	myvelocityz.resize(live);
+	m_restSteps.assign(restSteps, restSteps + live);
+	m_ballCost.assign(ballCost, ballCost + live);
+	m_spawnSerial.assign(spawnSerial, spawnSerial + live);
+	m_freeBalls.clear();
+	m_compactions++;
+	//the render data only ever held the live balls in this order, so it is unchanged
+	resizeBuffers();
+}
+
+void HPCAssignment::packRenderData()
+{
+	const uint32_t size = static_cast<uint32_t>(myballz.size());
+	if (m_freeBalls.empty()) {
+		HPCEngine::updateRenderData((const HPCEngine::RenderData* const*)myballz.blocks(), BallArray::s_blockItems, size,
+			m_renderLayout);
+		return;
+	}
+	//removed slots are left out so the renderer only sees live balls
+	const uint32_t live = getLiveBalls();
+	Vector3* packed = m_frameArena.allocate<Vector3>(live);
+	uint32_t count = 0;
+	myballz.forEachSpan(0, size, [&](uint32_t first, uint32_t last, const Vector3* balls) {
+		for (uint32_t current = first; current < last; current++) {
+			if (!isRemoved(current)) {
+				packed[count++] = balls[current - first];
+			}
+		}
+	});
+	HPCEngine::updateRenderData((const HPCEngine::RenderData*)packed, live, m_renderLayout);
+}
+
+void HPCAssignment::resizeBuffers()
+{
+	if (m_integration == Integration::TwoPass && m_solver == Solver::Force) {
+		//the second copy is not needed when integrating in place, its blocks (and arena slot) are kept
+		// for switching back
+		myballz2.clear();
+		myvelocityz2.clear();
+		m_forces.resize(myballz.size());
+		m_ballCost.resize(myballz.size());
+		m_restSteps.resize(myballz.size());
+		return;
+	}
+	m_forces.clear();
+	m_ballCost.resize(myballz.size());
+	m_restSteps.resize(myballz.size());
+	myballz2.reserve(myballz.size());
+	myballz2.resize(myballz.size());
+	myvelocityz2.reserve(myvelocityz.size());
+	myvelocityz2.resize(myvelocityz.size());
+}
+
+
+
+Vector3 HPCAssignment::ballAcceleration(uint32_t current, const Vector3* gravityVec)
+{
+	Vector3 kw = Vector3(-500);
+	Vector3 bw = Vector3(10);
+	Vector3 kb = Vector3(-300);
+	Vector3 bb = Vector3(5);
+
+	Vector3 pointp = myballz[current];
+	Vector3 radius = pointp.getR();
+	Vector3 pointv = myvelocityz[current];
+	//d = pa - pb ??????
+	Vector3 force = Vector3(0);
+
+	Vector3 four = Vector3(40.0);
+	Vector3 xp = (pointp + radius) - four;
+	Vector3 match = Vector3().lessThan(xp);//cmplt
+	Vector3 force2 = (((kw * xp) - (bw * pointv)));
+	force2 = force2 & match;
+	force += force2;
+
+	Vector3 xn = four + (pointp - radius);
+	Vector3 match2 = xn.lessThan(Vector3());
+	Vector3 force3 = (((kw * xn) - (bw * pointv)));
+	force3 = force3 & match2;
+	force += force3;
+
+	uint32_t contacts = 0;
+	//each span lies in one block of both arrays so the inner loop walks plain pointers
+	myballz.forEachSpan(0, static_cast<uint32_t>(myballz.size()), [&](uint32_t first, uint32_t last, const Vector3* balls) {
+		const Vector3* velocities = &myvelocityz[first];
+		for (uint32_t current2 = first; current2 < last; current2++) {
+
+			if (current != current2)
+			{
+				Vector3 pointp2 = balls[current2 - first];
+				Vector3 d = pointp - pointp2;
+				Vector3 length = d.length();
+				Vector3 radius2 = pointp2.getR();
+					if(length < (radius + radius2))
+					{
+						Vector3 pointv2 = velocities[current2 - first];
+						Vector3 nor = d / length;
+						Vector3 x = length - (radius + radius2);
+						Vector3 vs = (pointv - pointv2).dot3(nor);
+						//normalise = d / d.length
+
+						force += nor * ((kb * x) - (bb * vs));
+						contacts++;
+					}
+
+					
+			}
+		}
+	});
+
+	//remembered as the cost estimate of this ball for the next step's partition
+	m_ballCost[current] = contacts;
+
+	Vector3 accleration = (force / (radius + radius)) + *gravityVec;
+	if (m_longRange) {
+		accleration += m_longRangeAccel[current];
+	}
+	return accleration;
+}
+
+void HPCAssignment::doSomeBallStuff(uint32_t start, uint32_t end, const float elapsedTime, const Vector3* gravityVec)
+{
+	for (uint32_t current = start; current < end; current++)
+	{
+			if (isSleeping(current)) {
+				myballz2[current] = myballz[current];
+				myvelocityz2[current] = Vector3(0.0f);
+				continue;
+			}
+			Vector3 pointp = myballz[current];
+			Vector3 radius = pointp.getR();
+			Vector3 pointv = myvelocityz[current];
+			Vector3 accleration = ballAcceleration(current, gravityVec);
+
+			Vector3 newpos = pointp + ((pointv + (accleration * elapsedTime)) * elapsedTime);
+			newpos.setR(radius);
+			myballz2[current] = newpos;
+			//calculate velocity
+			Vector3 newvelocity = (newpos - pointp) / elapsedTime;
+			myvelocityz2[current] = newvelocity;
+			updateRest(current, newvelocity);
+	}
+
+
+}
+
+void HPCAssignment::computeForces(uint32_t start, uint32_t end, const Vector3* gravityVec)
+{
+	for (uint32_t current = start; current < end; current++)
+	{
+		if (!isSleeping(current)) {
+			m_forces[current] = ballAcceleration(current, gravityVec);
+		}
+	}
+}
+
+void HPCAssignment::integrate(uint32_t start, uint32_t end, const float elapsedTime)
+{
+	//every force has been computed so positions and velocities can be overwritten in place
+	for (uint32_t current = start; current < end; current++)
+	{
+		if (isSleeping(current)) {
+			myvelocityz[current] = Vector3(0.0f);
+			continue;
+		}
+		Vector3 pointp = myballz[current];
+		Vector3 radius = pointp.getR();
+		Vector3 newpos = pointp + ((myvelocityz[current] + (m_forces[current] * elapsedTime)) * elapsedTime);
+		newpos.setR(radius);
+		myvelocityz[current] = (newpos - pointp) / elapsedTime;
+		myballz[current] = newpos;
+		updateRest(current, myvelocityz[current]);
+	}
+}
+
+void HPCAssignment::xpbdPredict(uint32_t start, uint32_t end, const float elapsedTime, const Vector3* gravityVec)
+{
+	for (uint32_t current = start; current < end; current++)
+	{
+		m_wallLambdaLow[current] = Vector3(0);
+		m_wallLambdaHigh[current] = Vector3(0);
+		if (isRemoved(current)) {
+			myballz2[current] = myballz[current];
+			continue;
+		}
+		//unconstrained position using the current velocity and gravity
+		Vector3 pointp = myballz[current];
+		Vector3 radius = pointp.getR();
+		Vector3 accleration = *gravityVec;
+		if (m_longRange) {
+			accleration += m_longRangeAccel[current];
+		}
+		Vector3 newpos = pointp + ((myvelocityz[current] + (accleration * elapsedTime)) * elapsedTime);
+		newpos.setR(radius);
+		myballz2[current] = newpos;
+	}
+}
+
+void HPCAssignment::xpbdGather(uint32_t chunk, uint32_t start, uint32_t end)
+{
+	//balls this close to touching at the predicted position may collide during the iterations
+	Vector3 margin = Vector3(0.25f);
+
+	//room for a settled pile, so the lists do not grow a little more every step as it packs down
+	XPBDChunk& data = m_xpbdChunks[chunk];
+	data.m_contacts.clear();
+	data.m_contacts.reserve((end - start) * s_contactsPerBall);
+	data.m_lambdas.reserve((end - start) * s_contactsPerBall);
+	for (uint32_t current = start; current < end; current++)
+	{
+		m_contactBegin[current] = static_cast<uint32_t>(data.m_contacts.size());
+		if (isRemoved(current)) {
+			m_contactEnd[current] = m_contactBegin[current];
+			continue;
+		}
+		Vector3 pointp = myballz2[current];
+		Vector3 radius = pointp.getR() + margin;
+		myballz2.forEachSpan(0, static_cast<uint32_t>(myballz2.size()), [&](uint32_t first, uint32_t last, const Vector3* balls) {
+			for (uint32_t current2 = first; current2 < last; current2++) {
+				if (current != current2)
+				{
+					Vector3 pointp2 = balls[current2 - first];
+					Vector3 length = (pointp - pointp2).length();
+					if (length < (radius + pointp2.getR()))
+					{
+						data.m_contacts.push_back(current2);
+					}
+				}
+			}
+		});
+		m_contactEnd[current] = static_cast<uint32_t>(data.m_contacts.size());
+	}
+	data.m_lambdas.assign(data.m_contacts.size(), 0.0f);
+}
+
+void HPCAssignment::xpbdIterate(uint32_t chunk, uint32_t start, uint32_t end, const float elapsedTime,
+	const BallArray& in, BallArray& out)
+{
+	//compliance (inverse stiffness) and damping taken from the force model's spring constants
+	const float dt2 = elapsedTime * elapsedTime;
+	Vector3 alphaw = Vector3(1.0f / (500.0f * dt2));
+	Vector3 gammaw = Vector3(10.0f / (500.0f * elapsedTime));
+	Vector3 alphab = Vector3(1.0f / (300.0f * dt2));
+	Vector3 gammab = Vector3(5.0f / (300.0f * elapsedTime));
+	//over relaxation applied to the averaged jacobi corrections
+	const float relax = 1.5f;
+
+	Vector3 zero = Vector3(0);
+	Vector3 one = Vector3(1);
+	Vector3 four = Vector3(40.0);
+	XPBDChunk& data = m_xpbdChunks[chunk];
+	Vector3 residual = Vector3(0);
+
+	for (uint32_t current = start; current < end; current++)
+	{
+		if (isRemoved(current)) {
+			out[current] = in[current];
+			continue;
+		}
+		Vector3 pointp = in[current];
+		Vector3 radius = pointp.getR();
+		Vector3 w = one / (radius + radius);
+		Vector3 moved = pointp - myballz[current];
+		Vector3 delta = Vector3(0);
+		float count = 0.0f;
+
+		//-40 walls, gradient +1
+		Vector3 c = four + (pointp - radius);
+		Vector3 match = c.lessThan(zero);
+		Vector3 lambda = m_wallLambdaLow[current];
+		Vector3 dl = (zero - c - (alphaw * lambda) - (gammaw * moved)) / (((one + gammaw) * w) + alphaw);
+		dl = ((lambda + dl).max(zero) - lambda) & match;
+		m_wallLambdaLow[current] = lambda + dl;
+		delta += w * dl;
+		residual = residual.max((zero - c) & match);
+
+		//+40 walls, gradient -1
+		c = four - (pointp + radius);
+		Vector3 match2 = c.lessThan(zero);
+		lambda = m_wallLambdaHigh[current];
+		dl = (zero - c - (alphaw * lambda) + (gammaw * moved)) / (((one + gammaw) * w) + alphaw);
+		dl = ((lambda + dl).max(zero) - lambda) & match2;
+		m_wallLambdaHigh[current] = lambda + dl;
+		delta -= w * dl;
+		residual = residual.max((zero - c) & match2);
+		if ((match & one).max(match2 & one).maxComponent3() > 0.0f) {
+			count += 1.0f;
+		}
+
+		//ball contacts, gradient +n for this ball and -n for the other
+		for (uint32_t contact = m_contactBegin[current]; contact < m_contactEnd[current]; contact++) {
+			const uint32_t current2 = data.m_contacts[contact];
+			Vector3 pointp2 = in[current2];
+			Vector3 radius2 = pointp2.getR();
+			Vector3 d = pointp - pointp2;
+			Vector3 length = d.length();
+			Vector3 x = length - (radius + radius2);
+			if (x < zero)
+			{
+				Vector3 nor = d / length;
+				Vector3 w2 = one / (radius2 + radius2);
+				Vector3 vs = (moved - (pointp2 - myballz[current2])).dot3(nor);
+				lambda = Vector3(data.m_lambdas[contact]);
+				dl = (zero - x - (alphab * lambda) - (gammab * vs)) / (((one + gammab) * (w + w2)) + alphab);
+				dl = (lambda + dl).max(zero) - lambda;
+				data.m_lambdas[contact] = (lambda + dl).getX();
+				delta += nor * (w * dl);
+				residual = residual.max(zero - x);
+				count += 1.0f;
+			}
+		}
+
+		//jacobi averaging keeps the combined corrections from overshooting in dense piles
+		Vector3 newpos = pointp;
+		if (count > 0.0f) {
+			newpos += delta * (relax / count);
+		}
+		newpos.setR(radius);
+		out[current] = newpos;
+	}
+	data.m_residual = residual.maxComponent3();
+}
+
+void HPCAssignment::xpbdFinalise(uint32_t start, uint32_t end, const float elapsedTime, const BallArray& result)
+{
+	for (uint32_t current = start; current < end; current++)
+	{
+		Vector3 newpos = result[current];
+		myballz2[current] = newpos;
+		//velocity is the distance moved over the step
+		myvelocityz2[current] = (newpos - myballz[current]) / elapsedTime;
+	}
+}
+
+void HPCAssignment::runXPBD(const float elapsedTime, const Vector3* gravityVec)
+{
+	const size_t size = myballz.size();
+	m_xpbdChunks.resize(chunkCount(size));
+	m_contactBegin.resize(size);
+	m_contactEnd.resize(size);
+	m_wallLambdaLow.resize(size);
+	m_wallLambdaHigh.resize(size);
+	m_xpbdScratch.resize(size);
+
+	runBalls([&](uint32_t start, uint32_t end) {
+		xpbdPredict(start, end, elapsedTime, gravityVec);
+	}, ballWork());
+	const uint32_t numChunks = runChunks([&](uint32_t chunk, uint32_t start, uint32_t end) {
+		xpbdGather(chunk, start, end);
+	}, contactWork());
+
+	//each ball only ever writes its own position so the constraints are batched per chunk
+	BallArray* in = &myballz2;
+	BallArray* out = &m_xpbdScratch;
+	for (uint32_t i = 0; i < m_xpbdIterations; i++) {
+		runChunks([&](uint32_t chunk, uint32_t start, uint32_t end) {
+			xpbdIterate(chunk, start, end, elapsedTime, *in, *out);
+		}, ballWork());
+		std::swap(in, out);
+	}
+	runBalls([&](uint32_t start, uint32_t end) {
+		xpbdFinalise(start, end, elapsedTime, *in);
+	}, ballWork());
+
+	m_xpbdStepIterations = m_xpbdIterations;
+	m_xpbdResidual = 0.0f;
+	for (uint32_t i = 0; i < numChunks && m_xpbdIterations > 0; i++) {
+		m_xpbdResidual = max(m_xpbdResidual, m_xpbdChunks[i].m_residual);
+	}
+}
+
+void HPCAssignment::ccdSweep(uint32_t first, uint32_t last, const float elapsedTime, const BallArray& positions,
+	const BallArray& velocities)
+{
+	Vector3 zero = Vector3(0);
+	Vector3 one = Vector3(1);
+	Vector3 four = Vector3(40.0);
+	Vector3 tiny = Vector3(-0.0001f);
+
+	for (uint32_t k = first; k < last; k++)
+	{
+		const uint32_t current = m_ccdBalls[k];
+		Vector3 pointp = positions[current];
+		Vector3 radius = pointp.getR();
+		Vector3 pointv = velocities[current];
+		//swept segment covered during the step
+		Vector3 move = pointv * elapsedTime;
+		Vector3 start = pointp - move;
+
+		//time each wall plane is reached, lanes that never reach it are left at 1
+		Vector3 t = (four - radius - start) / move;
+		Vector3 match = zero.lessThan(move) & tiny.lessThan(t);
+		Vector3 timeHigh = one + ((t - one) & match);
+		t = (start - radius + four) / (zero - move);
+		match = move.lessThan(zero) & tiny.lessThan(t);
+		Vector3 timeLow = one + ((t - one) & match);
+		Vector3 timeWall = timeHigh.min(timeLow);
+		float hit = max(0.0f, 1.0f - (one - timeWall).maxComponent3());
+		bool wall = hit < 1.0f;
+
+		//time of impact against every other ball moving along its own segment
+		uint32_t other = 0;
+		Vector3 nor = Vector3(0);
+		positions.forEachSpan(0, static_cast<uint32_t>(positions.size()), [&](uint32_t begin, uint32_t end,
+			const Vector3* balls) {
+			const Vector3* moving = &velocities[begin];
+			for (uint32_t current2 = begin; current2 < end; current2++) {
+				if (current != current2)
+				{
+					Vector3 pointp2 = balls[current2 - begin];
+					Vector3 move2 = moving[current2 - begin] * elapsedTime;
+					Vector3 d = start - (pointp2 - move2);
+					Vector3 dm = move - move2;
+					Vector3 radii = radius + pointp2.getR();
+					const float b = d.dot3(dm).getX();
+					const float c = d.dot3(d).getX() - (radii * radii).getX();
+					//skip pairs that already overlap (left to the solver) or are separating
+					if (c < 0.0f || b >= 0.0f)
+					{
+						continue;
+					}
+					const float a = dm.dot3(dm).getX();
+					const float disc = (b * b) - (a * c);
+					if (disc < 0.0f)
+					{
+						continue;
+					}
+					const float toi = (-b - sqrtf(disc)) / a;
+					if (toi < hit)
+					{
+						hit = max(toi, 0.0f);
+						wall = false;
+						other = current2;
+						nor = d + (dm * hit);
+					}
+				}
+			}
+		});
+
+		if (hit >= 1.0f) {
+			m_ccdPositions[k] = pointp;
+			m_ccdVelocities[k] = pointv;
+			continue;
+		}
+		//stop the ball at the first contact and remove the approaching velocity
+		Vector3 newpos = start + (move * hit);
+		newpos.setR(radius);
+		if (wall) {
+			Vector3 hitAxes = timeWall.lessThan(Vector3(hit + 0.0001f));
+			pointv = pointv - (pointv & hitAxes);
+		} else {
+			nor = nor / nor.length();
+			Vector3 radius2 = positions[other].getR();
+			Vector3 vs = (pointv - velocities[other]).dot3(nor);
+			Vector3 share = radius2 / (radius + radius2);
+			pointv = pointv - (nor * (vs.min(zero) * share));
+		}
+		m_ccdPositions[k] = newpos;
+		m_ccdVelocities[k] = pointv;
+	}
+}
+
+void HPCAssignment::runCCD(const float elapsedTime, BallArray& positions, BallArray& velocities)
+{
+	//smallest ball radius is 0.5
+	const float limit = HPC_CCD_FRACTION * 0.5f;
+	Vector3 limit2 = Vector3(limit * limit);
+
+	m_ccdFound.resize(chunkCount(myballz.size()));
+	const uint32_t numChunks = runChunks([&](uint32_t chunk, uint32_t start, uint32_t end) {
+		//room for the whole chunk, so a step with more fast balls than before does not allocate
+		vector<uint32_t>& found = m_ccdFound[chunk];
+		found.clear();
+		found.reserve(end - start);
+		for (uint32_t current = start; current < end; current++)
+		{
+			Vector3 move = velocities[current] * elapsedTime;
+			if (limit2 < move.dot3(move))
+			{
+				found.push_back(current);
+			}
+		}
+	}, ballWork());
+
+	m_ccdBalls.clear();
+	m_ccdBalls.reserve(myballz.size());
+	for (uint32_t i = 0; i < numChunks; i++) {
+		m_ccdBalls.insert(m_ccdBalls.end(), m_ccdFound[i].begin(), m_ccdFound[i].end());
+	}
+	if (m_ccdBalls.empty()) {
+		return;
+	}
+
+	//sweep every fast ball against the step's positions then write back once all have finished
+	m_ccdPositions = m_frameArena.allocate<Vector3>(m_ccdBalls.size());
+	m_ccdVelocities = m_frameArena.allocate<Vector3>(m_ccdBalls.size());
+	runChunks(m_ccdBalls.size(), [&](uint32_t, uint32_t first, uint32_t last) {
+		ccdSweep(first, last, elapsedTime, positions, velocities);
+	}, contactWork());
+	for (uint32_t k = 0; k < m_ccdBalls.size(); k++) {
+		positions[m_ccdBalls[k]] = m_ccdPositions[k];
+		velocities[m_ccdBalls[k]] = m_ccdVelocities[k];
+	}
+}
+
+void HPCAssignment::updatePartition()
+{
+	//every ball tests every other ball, contacts then add extra work on top
+	const uint32_t size = static_cast<uint32_t>(myballz.size());
+	const uint64_t baseCost = size;
+	m_costPrefix.resize(size);
+	const uint64_t offset = parallel_scan(threads, size, m_costPrefix.data(), uint64_t(0), [&](uint32_t i) {
+		return baseCost + static_cast<uint64_t>(m_ballCost[i]) * HPC_CONTACT_COST;
+	}, plus<uint64_t>());
+
+	//one range per thread (plus the caller) each holding an equal share of the total cost
+	const uint32_t numRanges = static_cast<uint32_t>(threads.size() + 1);
+	m_costSplits.resize(numRanges + 1);
+	m_costSplits[0] = 0;
+	for (uint32_t i = 1; i < numRanges; i++) {
+		const uint64_t target = offset * i / numRanges;
+		const uint32_t split = static_cast<uint32_t>(
+			lower_bound(m_costPrefix.begin(), m_costPrefix.end(), target) - m_costPrefix.begin());
+		m_costSplits[i] = max(split, m_costSplits[i - 1]);
+	}
+	m_costSplits[numRanges] = size;
+}
+
+void HPCAssignment::runLongRange()
+{
+	m_longRangeAccel.resize(myballz.size());
+	//the tree indexes a single array, so it gets a contiguous copy of the positions
+	m_treePositions.resize(myballz.size());
+	runBalls([&](uint32_t start, uint32_t end) {
+		myballz.forEachSpan(start, end, [&](uint32_t first, uint32_t last, const Vector3* balls) {
+			copy(balls, balls + (last - first), m_treePositions.begin() + first);
+		});
+		//removed balls are given no mass at the centre so they neither attract nor stretch the tree
+		for (uint32_t current = start; current < end && !m_freeBalls.empty(); current++) {
+			if (isRemoved(current)) {
+				m_treePositions[current] = Vector3(0.0f);
+			}
+		}
+	}, ballWork());
+	m_tree.build(m_treePositions.data(), static_cast<uint32_t>(m_treePositions.size()));
+	//the tree walk visits far fewer nodes than there are balls, so this is an upper bound
+	runBalls([&](uint32_t start, uint32_t end) {
+		m_tree.accelerate(m_treePositions.data(), start, end, m_longRangeAccel.data());
+	}, contactWork());
+}
+
+void HPCAssignment::reportStats(const float elapsedTime)
+{
+	m_statsTime += elapsedTime;
+	if (m_statsTime < 1.0f) {
+		return;
+	}
+	m_statsTime = 0.0f;
+	//the log lines are built on the heap, once a second is not part of the steady frame loop
+	AllocationCounter::Pause pause;
+	if (m_solver == Solver::XPBD) {
+		char buffer[96];
+		snprintf(buffer, sizeof(buffer), "XPBD: %u iterations/step, residual %f\n", m_xpbdStepIterations,
+			m_xpbdResidual);
+		HPCEngine::logMessage(buffer);
+	}
+	if (m_ccd && !m_ccdBalls.empty()) {
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "CCD: %u balls swept\n", static_cast<uint32_t>(m_ccdBalls.size()));
+		HPCEngine::logMessage(buffer);
+	}
+	if (m_statsFree > 0 || m_statsCompactions != m_reportedCompactions) {
+		char buffer[96];
+		snprintf(buffer, sizeof(buffer), "Balls: %u live, %u free slots, packed %u times\n", m_statsLive, m_statsFree,
+			m_statsCompactions - m_reportedCompactions);
+		HPCEngine::logMessage(buffer);
+		m_reportedCompactions = m_statsCompactions;
+	}
+	//busy/idle time of each worker then the time this thread spent working/waiting on them
+	static const char* const scheduleNames[] = { "static", "dynamic", "guided", "cost model" };
+	const vector<ThreadPool::ThreadTime> times = threads.takeThreadTimes();
+	string line = string("Threads (") + scheduleNames[static_cast<int>(m_schedule)] + ") busy/idle ms:";
+	for (size_t i = 0; i < times.size(); i++) {
+		char buffer[48];
+		snprintf(buffer, sizeof(buffer), " %s%.1f/%.1f", (i + 1 == times.size()) ? "caller " : "", times[i].m_busy,
+			times[i].m_idle);
+		line += buffer;
+	}
+	HPCEngine::logMessage(line + "\n");
+
+	//only worth reporting when some packages are remote from others
+	uint64_t local;
+	uint64_t remote;
+	m_numa.takeAccesses(local, remote);
+	if (local + remote > 0) {
+		char buffer[128];
+		snprintf(buffer, sizeof(buffer), "NUMA (first touch %s): %.1f%% of ball updates remote (%llu local, %llu remote)\n",
+			m_numa.isEnabled() ? "on" : "off", 100.0 * remote / (local + remote), static_cast<unsigned long long>(local),
+			static_cast<unsigned long long>(remote));
+		HPCEngine::logMessage(buffer);
+	}
+
+	line = "Stages mean ms:";
+	for (const auto& timing : m_graph.timings()) {
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), " %s %.3f", timing.m_name.c_str(), timing.m_mean);
+		line += buffer;
+	}
+	HPCEngine::logMessage(line + "\n");
+}
+
+bool HPCAssignment::load() noexcept
+{
+    /* Add required start up code here */
+	static const char* const affinityNames[] = { "none", "compact", "scatter", "physical cores" };
+	char buffer[192];
+	snprintf(buffer, sizeof(buffer), "Thread pool: %u workers (%u for background work), affinity %s%s\n",
+		static_cast<uint32_t>(threads.size()), threads.m_backgroundLimit,
+		affinityNames[static_cast<int>(ThreadPool::Affinity::HPC_AFFINITY)],
+		HPC_RESERVE_RENDER_CORE ? ", render core reserved" : "");
+	HPCEngine::logMessage(buffer);
+	m_granularity.calibrate(threads);
+	snprintf(buffer, sizeof(buffer), "Granularity: %.2f us dispatch, %.2f ns a ball pair, %.2f ns a ball update\n",
+		m_granularity.getDispatchCost() * 1e-3, m_granularity.getPairCost(), m_granularity.getUpdateCost());
+	HPCEngine::logMessage(buffer);
+	m_tuningCache = AutoTuner::cachePath(HPC_TUNING_CACHE);
+	if (!m_tuningCache.empty()) {
+		snprintf(buffer, sizeof(buffer), "Auto tuner: %u ball count ranges read from %s\n",
+			m_tuner.load(m_tuningCache), m_tuningCache.c_str());
+		HPCEngine::logMessage(buffer);
+	}
+	if (m_arena.getSlots() > 0) {
+		//fault the arena in across the workers then give each ball array its slot so adding balls
+		// never moves them
+		static const char* const pageNames[] = { "4 KB pages", "4 KB pages (2 MB transparent huge pages requested)",
+			"2 MB huge pages" };
+		const auto start = chrono::steady_clock::now();
+		m_numa.useArena(&m_arena);
+		const size_t pages = m_numa.prefault(HPC_NUMA_STORAGE ? HPC_ARENA_BALLS : HPC_ARENA_PREFAULT);
+		for (BallArray* array : { &myballz, &myvelocityz, &myballz2, &myvelocityz2, &m_forces }) {
+			array->reserve(HPC_ARENA_BALLS);
+		}
+		snprintf(buffer, sizeof(buffer), "Particle arena: %u x %u balls on %s, %u pages prefaulted in %.2f ms\n",
+			s_arenaArrays, static_cast<uint32_t>(HPC_ARENA_BALLS), pageNames[static_cast<int>(m_arena.getPages())],
+			static_cast<uint32_t>(pages), chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+		HPCEngine::logMessage(buffer);
+	}
+	m_tree.setOpeningAngle(HPC_OPENING_ANGLE);
+	m_tree.setStrength(HPC_LONG_RANGE_STRENGTH);
+	buildGraph();
+	addBalls();
+    return true;
+}
+
+void HPCAssignment::buildGraph()
+{
+	//balls are only removed and packed between the solver passes, which see a fixed set of slots
+	const uint32_t spawn = m_graph.addStage("spawn", [this]() {
+		if (m_stepAddBalls || m_stepCount % s_escapeCheck == 0) {
+			removeEscaped();
+		}
+		if (m_stepAddBalls) {
+			addBalls();
+		}
+		if (!m_freeBalls.empty() && m_freeBalls.size() * HPC_COMPACT_SHARE >= myballz.size()) {
+			compactBalls();
+		}
+	});
+	const uint32_t broadphase = m_graph.addStage("broadphase", [this]() {
+		if (m_schedule == Schedule::CostModel) {
+			updatePartition();
+		}
+		if (m_longRange) {
+			runLongRange();
+		}
+	});
+	const uint32_t narrowphase = m_graph.addStage("narrowphase", [this]() {
+		stepContacts();
+	});
+	const uint32_t integration = m_graph.addStage("integrate", [this]() {
+		stepIntegrate();
+	});
+	//the stats only read results of the finished step so can overlap the start of the next one,
+	// queued as background work so they never hold up the next step's chunks
+	const uint32_t stats = m_graph.addStage("stats", [this]() {
+		reportStats(m_statsElapsed);
+	}, false, ThreadPool::Priority::Background);
+	const uint32_t render = m_graph.addStage("render packing", [this]() {
+		//only handed over once the whole step has finished so an in place step is never seen half written
+		packRenderData();
+	});
+	m_graph.addDependency(spawn, broadphase);
+	m_graph.addDependency(broadphase, narrowphase);
+	m_graph.addDependency(narrowphase, integration);
+	m_graph.addDependency(integration, stats);
+	m_graph.addDependency(integration, render);
+	//the next step's solver overwrites the iterations, residual and swept balls the stats report
+	m_graph.addFrameDependency(stats, narrowphase);
+}
+
+void HPCAssignment::stepContacts()
+{
+	if (m_solver == Solver::Force && m_integration == Integration::TwoPass) {
+		//all forces are written before any ball moves
+		runContacts([&](uint32_t start, uint32_t end) {
+			computeForces(start, end, &m_stepGravity);
+		});
+	} else if (m_solver == Solver::XPBD) {
+		runXPBD(m_stepTime, &m_stepGravity);
+	} else {
+		//thread pool of doSomeBallStuff
+		runContacts([&](uint32_t start, uint32_t end) {
+			doSomeBallStuff(start, end, m_stepTime, &m_stepGravity);
+		});
+	}
+}
+
+void HPCAssignment::stepIntegrate()
+{
+	if (m_solver == Solver::Force && m_integration == Integration::TwoPass) {
+		//every ball is integrated in place
+		runBalls([&](uint32_t start, uint32_t end) {
+			integrate(start, end, m_stepTime);
+		}, ballWork());
+		if (m_ccd) {
+			runCCD(m_stepTime, myballz, myvelocityz);
+		}
+	} else {
+		if (m_ccd) {
+			runCCD(m_stepTime, myballz2, myvelocityz2);
+		}
+
+		std::swap(myballz, myballz2);
+		std::swap(myvelocityz, myvelocityz2);
+	}
+	m_statsElapsed = m_stepTime;
+	//the ball lists change again from the next spawn stage (or removeBall between steps) while the stats
+	// may still be running, so they read a copy taken here
+	m_statsLive = getLiveBalls();
+	m_statsFree = static_cast<uint32_t>(m_freeBalls.size());
+	m_statsCompactions = m_compactions;
+}
+
+void HPCAssignment::run(const float elapsedTime, float* gravity, const bool addBall) noexcept
+{
+    /* Add required code here */
+    /* Note gravity can be converted to whatever Vector 3 type you are using through a simple cast
+       e.g. Vector3 gravityVec = *reinterpret_cast<Vector3*>(gravity);
+    */
+	m_stepGravity = *reinterpret_cast<Vector3*>(gravity);
+	m_stepTime = elapsedTime;
+	m_stepAddBalls = addBall;
+	m_stepCount++;
+	if (m_tuner.select(static_cast<uint32_t>(myballz.size()))) {
+		applyTuning();
+	}
+	//the previous step's stats may still be running but never use the frame arena
+	m_frameArena.reset();
+	const uint64_t allocations = AllocationCounter::count();
+	const auto start = chrono::steady_clock::now();
+	m_graph.run();
+	const double stepTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	if (HPC_COUNT_ALLOCATIONS) {
+		//buffers grow while new balls settle or the chunks change, after that a step must not allocate at all
+		if (addBall) {
+			m_warmupSteps = s_warmupSteps;
+		} else if (m_warmupSteps > 0) {
+			m_warmupSteps--;
+		} else {
+			assert(AllocationCounter::count() == allocations && "the frame loop allocates after warm-up");
+		}
+	}
+	//sleeping balls only apply to the force solver
+	const uint32_t applicable = (m_solver == Solver::XPBD) ? ~uint32_t(FrameBudget::SkipSleeping) : ~0U;
+	if (m_budget.update(stepTime, applicable)) {
+		applyBudget();
+		//steps at the new quality level are not comparable with those timed before it
+		m_tuner.restart();
+	} else if (m_tuner.update(stepTime)) {
+		applyTuning();
+	}
+}
+
+void HPCAssignment::applyBudget()
+{
+	m_warmupSteps = s_warmupSteps;
+	//coarse steps also halve the XPBD iterations, the stats stage only reads the count a step ran with
+	m_skipSleeping = m_budget.isActive(FrameBudget::SkipSleeping);
+	m_xpbdIterations = m_budget.isActive(FrameBudget::CoarseSteps) ? max(HPC_XPBD_ITERATIONS / 2, 1) :
+		HPC_XPBD_ITERATIONS;
+}
+
+void HPCAssignment::applyTuning()
+{
+	m_warmupSteps = s_warmupSteps;
+	//chunkCount() and runBalls() read the other settings as they run
+	m_granularity.setThreadLimit(m_tuner.getSettings().m_threads);
+}
+
+void HPCAssignment::unload() noexcept
+{
+    /* Add required shut down code here */
+	m_graph.wait();
+	if (HPC_STAGE_TIMINGS[0] != '\0') {
+		m_graph.exportTimings(HPC_STAGE_TIMINGS);
+	}
+	//only rewrite the cache when this run tuned something
+	if (m_tuner.hasImproved() && !m_tuningCache.empty()) {
+		m_tuner.save(m_tuningCache);
+	}
+}
+
+void HPCAssignment::setSolver(const Solver solver) noexcept
+{
+	m_solver = solver;
+	resizeBuffers();
+}
+
+HPCAssignment::Solver HPCAssignment::getSolver() const noexcept
+{
+	return m_solver;
+}
+
+void HPCAssignment::setIntegration(const Integration integration) noexcept
+{
+	m_integration = integration;
+	resizeBuffers();
+}
+
+HPCAssignment::Integration HPCAssignment::getIntegration() const noexcept
+{
+	return m_integration;
+}
+
+void HPCAssignment::setLongRange(const bool enabled) noexcept
+{
+	m_longRange = enabled;
+}
+
+bool HPCAssignment::getLongRange() const noexcept
+{
+	return m_longRange;
+}
+
+void HPCAssignment::setSchedule(const Schedule schedule) noexcept
+{
+	m_schedule = schedule;
+}
+
+HPCAssignment::Schedule HPCAssignment::getSchedule() const noexcept
+{
+	return m_schedule;
+}
+
+const FrameBudget& HPCAssignment::getBudget() const noexcept
+{
+	return m_budget;
+}
+
+void HPCAssignment::addAttractor(const float x, const float y, const float z, const float mass)
+{
+	m_tree.addAttractor(Vector3(x, y, z), mass);
+}
@@ -14,8 +14,10 @@
  * more complex aspects of completing the HPC Assignment.
  */
 #include "HPCEngine.h"
+#include <algorithm>
 #include <cmath>
 #include <chrono>
+#include <thread>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #define REQ_GLVERSION_MAJOR 3
@@ -32,8 +34,17 @@
 #ifndef WINDWINDOWHEIGHTOWWIDTH
 #   define WINDOWHEIGHT 900
 #endif
+#ifndef SIMULATIONRATE
+#   define SIMULATIONRATE 0    // Fixed simulation steps per second, rendered interpolated between ticks (0 steps once per loop using the elapsed time, without interpolation)
+#endif
+#ifndef MAXSIMULATIONSTEPS
+#   define MAXSIMULATIONSTEPS 8
+#endif
 #define FONTSIZE 32
 
+using clock_type = std::conditional<std::chrono::high_resolution_clock::is_steady, std::chrono::high_resolution_clock,
+    std::chrono::steady_clock>::type;
+
 // forward declarations
 char g_charHPCRenderShaderVertex[];
 char g_charHPCRenderShaderFragment[];
@@ -642,8 +653,36 @@ void HPCEngine::glRenderSpheres() const noexcept
     // Bind the Instanced buffer
     glBindBuffer(GL_ARRAY_BUFFER, g_hpc.m_sphereABO);
 
-    // Allocate the array object and copy from existing positions
-    glBufferData(GL_ARRAY_BUFFER, g_hpc.m_numSpheres * sizeof(RenderData), g_hpc.m_renderData, GL_DYNAMIC_READ);
+    // Allocate a new array object and fill it directly with the blended positions
+    const GLsizeiptr size = g_hpc.m_numSpheres * sizeof(RenderData);
+    glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    if (size > 0) {
+        auto* instances = static_cast<float*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        if (instances != nullptr) {
+            const std::vector<RenderData>& current = g_hpc.m_tickStates[g_hpc.m_renderStates[1]];
+            const std::vector<RenderData>& previous = g_hpc.m_tickStates[g_hpc.m_renderStates[0]];
+            const auto* currentData = reinterpret_cast<const float*>(current.data());
+            const auto* previousData = reinterpret_cast<const float*>(previous.data());
+
+            // Lerp each sphere (position and radius fit a single register), new spheres have nothing to blend from
+            // and once spheres have moved index neither does any other
+            const bool sameLayout = g_hpc.m_renderLayouts[0] == g_hpc.m_renderLayouts[1];
+            const uint32_t numBlended = (g_hpc.m_renderAlpha < 1.0f && sameLayout) ?
+                std::min(static_cast<uint32_t>(previous.size()), g_hpc.m_numSpheres) : 0;
+            const __m128 alpha = _mm_set1_ps(g_hpc.m_renderAlpha);
+            uint32_t i = 0;
+            for (; i < numBlended; i++) {
+                const __m128 from = _mm_loadu_ps(&previousData[i * 4]);
+                const __m128 to = _mm_loadu_ps(&currentData[i * 4]);
+                _mm_storeu_ps(&instances[i * 4], _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(to, from), alpha)));
+            }
+            for (; i < g_hpc.m_numSpheres; i++) {
+                _mm_storeu_ps(&instances[i * 4], _mm_loadu_ps(&currentData[i * 4]));
+            }
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+    }
 
     // Draw the instanced spheres
     glUseProgram(m_sphereProgram);
@@ -656,16 +695,13 @@ void HPCEngine::glRenderText() noexcept
     // Determine required text string
     if (m_frameTime >= 1.0f) {
         // Get second accurate frame rate
-        const float fps = static_cast<float>(m_frameNumber) / m_frameTime;
+        const float fps = static_cast<float>(m_frameNumber.exchange(0)) / m_frameTime;
 
         // Reset time to overflow time
         do {
             m_frameTime -= 1.0f;
         } while (m_frameTime >= 1.0f);
 
-        // Reset counter
-        m_frameNumber = 0;
-
         //Update the overlay
         glUpdateText(fps);
     }
@@ -802,15 +838,15 @@ bool HPCEngine::run() noexcept
 
     // Initialise OpenGL
     if (g_hpc.glInit()) {
+        // Run the simulation on its own thread, completed steps are picked up through m_frames
+        std::thread simulation(&HPCEngine::simulate, &g_hpc);
+
         // Initialise elapsed time
-        using clock_type = std::conditional<std::chrono::high_resolution_clock::is_steady, std::chrono::
-            high_resolution_clock, std::chrono::steady_clock>::type;
         auto currentTime = clock_type::now();
         // Start the program message pump
         SDL_Event event;
         while (!g_hpc.m_shutdown) {
-            // Poll SDL for buffered events
-            bool addBalls = false;
+            // Poll SDL for buffered events, anything changing the simulation is passed on to its thread
             while (SDL_PollEvent(&event) != 0) {
                 if (event.type == SDL_QUIT) {
                     g_hpc.m_shutdown = true;
@@ -818,54 +854,63 @@ bool HPCEngine::run() noexcept
                     if (event.key.keysym.sym == SDLK_ESCAPE) {
                         g_hpc.m_shutdown = true;
                     } else if (event.key.keysym.sym == SDLK_SPACE) {
-                        addBalls = true;
+                        g_hpc.m_commands.fetch_or(AddBalls);
                     } else if (event.key.keysym.sym == SDLK_p) {
-                        g_hpc.m_updateGravity = !g_hpc.m_updateGravity;
+                        g_hpc.m_commands.fetch_or(ToggleGravity);
+                    } else if (event.key.keysym.sym == SDLK_x) {
+                        // Toggle between the force and position based solvers
+                        g_hpc.m_commands.fetch_or(ToggleSolver);
+                    } else if (event.key.keysym.sym == SDLK_g) {
+                        // Toggle the long range attraction between balls
+                        g_hpc.m_commands.fetch_or(ToggleLongRange);
+                    } else if (event.key.keysym.sym == SDLK_s) {
+                        // Cycle between the static, dynamic, guided and cost model thread schedules
+                        g_hpc.m_commands.fetch_or(CycleSchedule);
                     }
                 }
             }
             // Update elapsed frame time
             const auto oldTime = currentTime;
             currentTime = clock_type::now();
-            auto elapsed = currentTime - oldTime;
-
-            // Enforce fixed max frame rate to prevent elapsed time getting to small and causing precision errors
-            while (elapsed < std::chrono::microseconds(500)) {
-                currentTime = clock_type::now();
-                elapsed = currentTime - oldTime;
-            }
-            const float elapsedTime = std::chrono::duration_cast<std::chrono::duration<float>>(elapsed).count();
-
-            // Calculate new rotation
-            if (g_hpc.m_updateGravity) {
-                if (fabs(g_hpc.m_rotationAngle) > 1.0f) {
-                    g_hpc.m_rotationSign = (g_hpc.m_rotationAngle < 0.0f) ? 1.0f : -1.0f;
-                }
-                g_hpc.m_rotationAngle += (g_hpc.m_rotationSign * elapsedTime * 0.2f) * (1.1f - (g_hpc.m_rotationAngle *
-                    g_hpc.m_rotationAngle));
-            }
+            const float elapsedTime = std::chrono::duration_cast<std::chrono::duration<float>>(currentTime - oldTime)
+                .count();
 
-            // Calculate rotation transform
-            const float sinAngle = sinf(g_hpc.m_rotationAngle);
-            const float cosAngle = cosf(g_hpc.m_rotationAngle);
-            const HPCVec3 rot1(-sinAngle, cosAngle, 0.0f);
-            const HPCVec3 rot2(cosAngle, sinAngle, 0.0f);
-
-            // Calculate the returned gravity using the rotation matrix
-            HPCVec3 gravity(0.0f, -9.81f, 0.0f);
-            const HPCVec3 temp = (rot1 * gravity.getY()) + (rot2 * gravity.getX());
-            gravity = HPCVec3(_mm_blend_ps(temp.m_vec3, _mm_add_ps(temp.m_vec3, gravity.m_vec3), 0x4));
-
-            // Run the state function
-            g_hpc.m_assignment.run(elapsedTime, reinterpret_cast<float*>(&gravity), addBalls);
-
-            //Only render the scene at max 60fps
+            //Only render the scene at max 60fps, or 30fps while the frame budget has reduced the render rate
             g_hpc.m_renderTime += elapsedTime;
             g_hpc.m_frameTime += elapsedTime;
-            constexpr float desiredFrameTime = (1.0 / 60.0);
+            const float desiredFrameTime =
+                g_hpc.m_assignment.getBudget().isActive(FrameBudget::ReducedRender) ? (1.0f / 30.0f) : (1.0f / 60.0f);
             if (g_hpc.m_renderTime >= desiredFrameTime) {
-                // Update camera
-                g_hpc.glUpdateCamera(rot1, rot2);
+                // Pick up the newest completed step along with the tick before it to blend from, so skipped
+                // steps never leave the renderer blending between states further apart than a tick
+                if (g_hpc.m_frames.acquire()) {
+                    // The states stay unchanged until the next acquire as the frame still refers to them
+                    const SimulationFrame& frame = g_hpc.m_frames.front();
+                    g_hpc.m_renderStates[1] = frame.m_state;
+                    g_hpc.m_renderStates[0] = frame.m_previousState;
+                    g_hpc.m_renderLayouts[1] = frame.m_layout;
+                    g_hpc.m_renderLayouts[0] = frame.m_previousLayout;
+                    g_hpc.m_numSpheres = static_cast<uint32_t>(g_hpc.m_tickStates[frame.m_state].size());
+                    g_hpc.m_renderAngle = frame.m_rotationAngle;
+                    g_hpc.m_stateFraction = frame.m_tickFraction;
+                    g_hpc.m_stateTime = frame.m_time;
+                }
+#if SIMULATIONRATE > 0
+                // Blend by how far the simulation clock was into the next tick when the step was run, plus the
+                // time since then
+                const float sinceState = std::chrono::duration_cast<std::chrono::duration<float>>(
+                    std::chrono::steady_clock::now() - g_hpc.m_stateTime).count();
+                const float stepRate = g_hpc.m_assignment.getBudget().isActive(FrameBudget::CoarseSteps) ?
+                    SIMULATIONRATE * 0.5f : SIMULATIONRATE;
+                g_hpc.m_renderAlpha = std::min(g_hpc.m_stateFraction + sinceState * stepRate, 1.0f);
+#else
+                g_hpc.m_renderAlpha = 1.0f;
+#endif
+
+                // Update camera to match the gravity of the rendered state
+                const float sinAngle = sinf(g_hpc.m_renderAngle);
+                const float cosAngle = cosf(g_hpc.m_renderAngle);
+                g_hpc.glUpdateCamera(HPCVec3(-sinAngle, cosAngle, 0.0f), HPCVec3(cosAngle, sinAngle, 0.0f));
 
                 // Render the scene
                 g_hpc.glRender();
@@ -877,9 +922,15 @@ bool HPCEngine::run() noexcept
                 do {
                     g_hpc.m_renderTime -= desiredFrameTime;
                 } while (g_hpc.m_renderTime >= desiredFrameTime);
+            } else if (desiredFrameTime - g_hpc.m_renderTime > 0.002f) {
+                // Nothing to do until the next frame is due
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
             }
         }
 
+        // Wait for the simulation to finish its current step
+        simulation.join();
+
         // Delete any created GL resources
         g_hpc.glQuit();
     }
@@ -891,6 +942,109 @@ bool HPCEngine::run() noexcept
     return g_hpc.m_shutdown;
 }
 
+void HPCEngine::simulate() noexcept
+{
+    // Configure this thread for DAZ and FLZ Mode operations as the constructor did for the main thread
+    _mm_setcsr((_mm_getcsr() & ~0x8800UL) | 0x8800UL);
+    _mm_setcsr((_mm_getcsr() & ~0x0140UL) | 0x0140UL);
+    // Steps are run on this thread, load() ran on the render thread
+    AllocationCounter::trackThread();
+
+    // Initialise elapsed time
+    auto currentTime = clock_type::now();
+    // Kept until a step has spawned the balls, a pass may run no steps
+    bool addBalls = false;
+    while (!m_shutdown) {
+        // Apply any requests from the render thread between steps
+        const uint32_t commands = m_commands.exchange(0);
+        addBalls = addBalls || (commands & AddBalls) != 0;
+        if ((commands & ToggleGravity) != 0) {
+            m_updateGravity = !m_updateGravity;
+        }
+        if ((commands & ToggleSolver) != 0) {
+            m_assignment.setSolver((m_assignment.getSolver() == HPCAssignment::Solver::XPBD) ?
+                HPCAssignment::Solver::Force : HPCAssignment::Solver::XPBD);
+        }
+        if ((commands & ToggleLongRange) != 0) {
+            m_assignment.setLongRange(!m_assignment.getLongRange());
+        }
+        if ((commands & CycleSchedule) != 0) {
+            const auto schedule = m_assignment.getSchedule();
+            m_assignment.setSchedule((schedule == HPCAssignment::Schedule::CostModel) ?
+                HPCAssignment::Schedule::Static : static_cast<HPCAssignment::Schedule>(static_cast<int>(schedule) + 1));
+        }
+
+        // Update elapsed frame time
+        const auto oldTime = currentTime;
+        currentTime = clock_type::now();
+        auto elapsed = currentTime - oldTime;
+
+        // Enforce fixed max frame rate to prevent elapsed time getting to small and causing precision errors
+        while (elapsed < std::chrono::microseconds(500)) {
+            currentTime = clock_type::now();
+            elapsed = currentTime - oldTime;
+        }
+        const float elapsedTime = std::chrono::duration_cast<std::chrono::duration<float>>(elapsed).count();
+
+        // Calculate new rotation
+        if (m_updateGravity) {
+            if (fabs(m_rotationAngle) > 1.0f) {
+                m_rotationSign = (m_rotationAngle < 0.0f) ? 1.0f : -1.0f;
+            }
+            m_rotationAngle += (m_rotationSign * elapsedTime * 0.2f) * (1.1f - (m_rotationAngle * m_rotationAngle));
+        }
+
+        // Calculate rotation transform
+        const float sinAngle = sinf(m_rotationAngle);
+        const float cosAngle = cosf(m_rotationAngle);
+        const HPCVec3 rot1(-sinAngle, cosAngle, 0.0f);
+        const HPCVec3 rot2(cosAngle, sinAngle, 0.0f);
+
+        // Calculate the returned gravity using the rotation matrix
+        HPCVec3 gravity(0.0f, -9.81f, 0.0f);
+        const HPCVec3 temp = (rot1 * gravity.getY()) + (rot2 * gravity.getX());
+        gravity = HPCVec3(_mm_blend_ps(temp.m_vec3, _mm_add_ps(temp.m_vec3, gravity.m_vec3), 0x4));
+
+        // Run the state function
+#if SIMULATIONRATE > 0
+        // Step at a fixed rate, the renderer blends the remaining fraction of a tick from the last two states.
+        // While the frame budget has coarsened the steps two ticks are run as one step.
+        constexpr float simulationTick = 1.0f / SIMULATIONRATE;
+        const float stepTime = m_assignment.getBudget().isActive(FrameBudget::CoarseSteps) ? simulationTick * 2.0f :
+            simulationTick;
+        m_simulationTime += elapsedTime;
+        uint32_t steps = 0;
+        while (m_simulationTime >= stepTime) {
+            if (steps == MAXSIMULATIONSTEPS) {
+                // Too far behind, drop the backlog rather than spiralling
+                m_simulationTime = 0.0f;
+                break;
+            }
+            // The renderer blends towards this step by how far past it the simulation clock is
+            m_tickFraction = (m_simulationTime - stepTime) / stepTime;
+            m_tickTime = currentTime;
+            m_assignment.run(stepTime, reinterpret_cast<float*>(&gravity), addBalls);
+            m_simulationTime -= stepTime;
+            addBalls = false;
+            ++steps;
+        }
+        if (steps == 0 && stepTime - m_simulationTime > 0.002f) {
+            // Nothing to do until the next tick is due
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+#else
+        // While the frame budget has coarsened the steps two frames are run as one step
+        m_simulationTime += elapsedTime;
+        m_deferredStep = m_assignment.getBudget().isActive(FrameBudget::CoarseSteps) && !m_deferredStep;
+        if (!m_deferredStep) {
+            m_assignment.run(m_simulationTime, reinterpret_cast<float*>(&gravity), addBalls);
+            m_simulationTime = 0.0f;
+            addBalls = false;
+        }
+#endif
+    }
+}
+
 void HPCEngine::shutdown() noexcept
 {
     g_hpc.m_shutdown = true;
@@ -901,16 +1055,52 @@ void HPCEngine::logMessage(const std::string& message) noexcept
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, message.c_str());
 }
 
-void HPCEngine::updateRenderData(const RenderData* renderData, const uint32_t numRenderItems) noexcept
+void HPCEngine::updateRenderData(const RenderData* renderData, const uint32_t numRenderItems,
+    const uint32_t layout) noexcept
 {
-    //Update internal pointer (requires pointer to remain valid till next frame)
-    g_hpc.m_renderData = renderData;
+    updateRenderData(&renderData, std::max(numRenderItems, 1U), numRenderItems, layout);
+}
 
-    // Update number of render items
-    g_hpc.m_numSpheres = numRenderItems;
+void HPCEngine::updateRenderData(const RenderData* const* blocks, const uint32_t blockItems,
+    const uint32_t numRenderItems, const uint32_t layout) noexcept
+{
+    // Copy the step into a state buffer neither published frame refers to, the last published states are one
+    // of them so stay as they are to go with it as the tick before
+    const SimulationFrame& first = g_hpc.m_frames.published(0);
+    const SimulationFrame& second = g_hpc.m_frames.published(1);
+    uint32_t state = 0;
+    for (; state < s_tickStates; state++) {
+        if (state != first.m_state && state != first.m_previousState && state != second.m_state &&
+            state != second.m_previousState && state != g_hpc.m_lastState) {
+            break;
+        }
+    }
+    std::vector<RenderData>& spheres = g_hpc.m_tickStates[state];
+    spheres.clear();
+    for (uint32_t item = 0; item < numRenderItems; item += blockItems) {
+        const RenderData* block = blocks[item / blockItems];
+        spheres.insert(spheres.end(), block, block + std::min(blockItems, numRenderItems - item));
+    }
+
+    // Fill the back frame and publish it as the newest completed step
+    SimulationFrame& frame = g_hpc.m_frames.back();
+    frame.m_state = state;
+    frame.m_layout = layout;
+    frame.m_previousState = g_hpc.m_lastState;
+    frame.m_previousLayout = g_hpc.m_lastLayout;
+    g_hpc.m_lastState = state;
+    g_hpc.m_lastLayout = layout;
+#if SIMULATIONRATE > 0
+    frame.m_tickFraction = g_hpc.m_tickFraction;
+    frame.m_time = g_hpc.m_tickTime;
+#else
+    frame.m_time = std::chrono::steady_clock::now();
+#endif
+    frame.m_rotationAngle = g_hpc.m_rotationAngle;
+    g_hpc.m_frames.publish();
 
     //Update frame counter
-    g_hpc.m_frameNumber++;
+    g_hpc.m_frameNumber.fetch_add(1, std::memory_order_relaxed);
 }
 
 char g_charHPCRenderShaderVertex[] =
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <new>
+#include "NumaStorage.h"
+#include "Vector3_SSE.h"
+#ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <Windows.h>
+#else
+#    include <sys/mman.h>
+#endif
+
+using namespace std;
+
+NumaStorage::NumaStorage(ThreadPool& pool, const bool enabled)
+	: m_pool(pool)
+	, m_enabled(enabled)
+	, m_packages(pool.packageCount())
+{
+}
+
+void NumaStorage::useArena(ParticleArena* arena)
+{
+	m_arena = arena;
+	m_prefaulted = 0;
+}
+
+size_t NumaStorage::prefault(const size_t balls)
+{
+	if (m_arena == nullptr || m_arena->getSlots() == 0) {
+		return 0;
+	}
+	//blocks go to the workers in turn as runChunks hands them out. Only reserved huge pages are
+	// sure to be placed whole, by the owner of their first block, transparent ones may be split
+	// back into normal pages so each block writes its own
+	const size_t pageSize = m_arena->getPageSize();
+	const size_t placedSize = (m_arena->getPages() == ParticleArena::Pages::Huge) ? pageSize : s_pageSize;
+	const size_t blockBytes = s_blockBalls * sizeof(Vector3);
+	const size_t bytes = min(balls * sizeof(Vector3), m_arena->getSlotBytes());
+	const uint32_t pages = static_cast<uint32_t>((bytes + pageSize - 1) / pageSize);
+	const size_t prefaulted = static_cast<size_t>(pages) * pageSize;
+	const uint32_t blocks = static_cast<uint32_t>((prefaulted + blockBytes - 1) / blockBytes);
+	const uint32_t slots = m_arena->getSlots();
+	m_blockHome.resize(max<size_t>(m_blockHome.size(), blocks), 0);
+	m_pool.parallel_for(0, blocks, 1, [&](uint32_t first, uint32_t last) {
+		for (uint32_t block = first; block < last; block++) {
+			const size_t begin = block * blockBytes;
+			const size_t end = min(begin + blockBytes, prefaulted);
+			for (uint32_t slot = 0; slot < slots; slot++) {
+				char* memory = m_arena->getSlot(slot);
+				for (size_t page = (begin + placedSize - 1) / placedSize * placedSize; page < end; page += placedSize) {
+					for (size_t offset = page; offset < page + placedSize; offset += s_pageSize) {
+						memory[offset] = 0;
+					}
+				}
+			}
+			m_blockHome[block] = m_pool.currentPackage();
+		}
+	}, ThreadPool::Schedule::Owned);
+	const size_t pageBlocks = max<size_t>(placedSize / blockBytes, 1);
+	for (uint32_t block = 0; block < blocks; block++) {
+		m_blockHome[block] = m_blockHome[block / pageBlocks * pageBlocks];
+	}
+	m_prefaulted = prefaulted;
+	return static_cast<size_t>(pages) * slots;
+}
+
+void* NumaStorage::allocateBlock(void*& slot, const size_t firstBall, const size_t bytes, const size_t itemSize)
+{
+	//an array takes a slot with its first block and keeps its blocks in it while they fit
+	if (m_arena != nullptr && slot == nullptr && firstBall == 0) {
+		slot = m_arena->take(m_arena->getSlotBytes());
+	}
+	const size_t offset = firstBall * itemSize;
+	if (slot != nullptr && offset + bytes <= m_arena->getSlotBytes()) {
+		//pages past the prefaulted part are placed by whichever thread writes them first
+		const size_t first = max(offset, m_prefaulted) / itemSize / s_blockBalls;
+		const size_t last = ((offset + bytes) / itemSize + s_blockBalls - 1) / s_blockBalls;
+		if (last > first) {
+			setHome(first, last);
+		}
+		return static_cast<char*>(slot) + offset;
+	}
+	return allocate(bytes, itemSize, firstBall);
+}
+
+void NumaStorage::freeBlock(void* slot, void* memory, const size_t bytes)
+{
+	char* slotStart = static_cast<char*>(slot);
+	char* block = static_cast<char*>(memory);
+	if (slot != nullptr && block >= slotStart && block < slotStart + m_arena->getSlotBytes()) {
+		return;
+	}
+	deallocate(memory, bytes);
+}
+
+void NumaStorage::releaseSlot(void*& slot)
+{
+	if (slot != nullptr) {
+		m_arena->give(slot);
+		slot = nullptr;
+	}
+}
+
+void* NumaStorage::allocate(const size_t bytes, const size_t itemSize, const size_t firstBall)
+{
+	const size_t firstBlock = firstBall / s_blockBalls;
+	const size_t lastBlock = (firstBall + bytes / itemSize + s_blockBalls - 1) / s_blockBalls;
+	if (!m_enabled || bytes < s_pageSize) {
+		//the array is filled on this thread
+		void* memory = ::operator new(bytes, align_val_t(64));
+		setHome(firstBlock, lastBlock);
+		return memory;
+	}
+
+	//freshly mapped pages are not placed until first written
+#ifdef _WIN32
+	void* memory = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (memory == nullptr) {
+		throw bad_alloc();
+	}
+#else
+	void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		throw bad_alloc();
+	}
+#endif
+	m_blockHome.resize(max(m_blockHome.size(), lastBlock), 0);
+	char* bytePointer = static_cast<char*>(memory);
+	const size_t blockBytes = s_blockBalls * itemSize;
+	m_pool.parallel_for(static_cast<uint32_t>(firstBlock), static_cast<uint32_t>(lastBlock), 1,
+		[&](uint32_t first, uint32_t last) {
+		for (uint32_t block = first; block < last; block++) {
+			//write every page starting in the block, a page shared with the previous block is
+			// already placed
+			const size_t begin = (block - firstBlock) * blockBytes;
+			const size_t end = min(begin + blockBytes, bytes);
+			for (size_t page = (begin + s_pageSize - 1) / s_pageSize * s_pageSize; page < end; page += s_pageSize) {
+				bytePointer[page] = 0;
+			}
+			m_blockHome[block] = m_pool.currentPackage();
+		}
+	}, ThreadPool::Schedule::Owned);
+	return memory;
+}
+
+void NumaStorage::deallocate(void* memory, const size_t bytes)
+{
+	if (!m_enabled || bytes < s_pageSize) {
+		::operator delete(memory, align_val_t(64));
+		return;
+	}
+#ifdef _WIN32
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, bytes);
+#endif
+}
+
+bool NumaStorage::isEnabled() const
+{
+	return m_enabled;
+}
+
+uint32_t NumaStorage::packageCount() const
+{
+	return m_packages;
+}
+
+void NumaStorage::setHome(const size_t first, const size_t last)
+{
+	m_blockHome.resize(max(m_blockHome.size(), last), 0);
+	fill(m_blockHome.begin() + first, m_blockHome.begin() + last, m_pool.currentPackage());
+}
+
+void NumaStorage::countAccess(const uint32_t start, const uint32_t end)
+{
+	//every access is local with a single package
+	if (m_packages <= 1 || start >= end) {
+		return;
+	}
+	const uint32_t package = m_pool.currentPackage();
+	uint64_t local = 0;
+	uint64_t remote = 0;
+	for (uint32_t block = start / s_blockBalls; block * s_blockBalls < end; block++) {
+		const uint32_t balls = min(end, (block + 1) * s_blockBalls) - max(start, block * s_blockBalls);
+		const bool home = block >= m_blockHome.size() || m_blockHome[block] == package;
+		(home ? local : remote) += balls;
+	}
+	m_local.fetch_add(local, memory_order_relaxed);
+	m_remote.fetch_add(remote, memory_order_relaxed);
+}
+
+void NumaStorage::takeAccesses(uint64_t& local, uint64_t& remote)
+{
+	local = m_local.exchange(0, memory_order_relaxed);
+	remote = m_remote.exchange(0, memory_order_relaxed);
+}
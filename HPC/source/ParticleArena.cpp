@@ -0,0 +1,165 @@
+#include <cstdint>
+#include "ParticleArena.h"
+#ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <Windows.h>
+#else
+#    include <fstream>
+#    include <string>
+#    include <sys/mman.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+/**
+* Enables the privilege needed to allocate large pages for this process.
+* @return True if the privilege is held.
+*/
+static bool enableLargePages()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+		return false;
+	}
+	TOKEN_PRIVILEGES privileges = {};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled;
+}
+#else
+/**
+* Checks if the kernel merges the pages a process asks for into transparent huge pages.
+* @return True if transparent huge pages are enabled always or on request.
+*/
+static bool transparentHugePages()
+{
+	ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+	string modes;
+	getline(file, modes);
+	return modes.find("[always]") != string::npos || modes.find("[madvise]") != string::npos;
+}
+#endif
+
+ParticleArena::ParticleArena(const size_t slotBytes, const uint32_t slots)
+{
+	if (slotBytes == 0 || slots == 0) {
+		return;
+	}
+	m_slotBytes = (slotBytes + s_hugePageSize - 1) / s_hugePageSize * s_hugePageSize;
+	if (map(m_slotBytes * slots)) {
+		m_used.resize(slots, false);
+	}
+}
+
+ParticleArena::~ParticleArena()
+{
+	if (m_mapping == nullptr) {
+		return;
+	}
+#ifdef _WIN32
+	VirtualFree(m_mapping, 0, MEM_RELEASE);
+#else
+	munmap(m_mapping, m_mappedBytes);
+#endif
+}
+
+bool ParticleArena::map(const size_t bytes)
+{
+#ifdef _WIN32
+	//large pages are committed and locked in memory as they are allocated
+	const size_t largePage = GetLargePageMinimum();
+	if (largePage != 0 && s_hugePageSize % largePage == 0 && enableLargePages()) {
+		m_mapping = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		m_pages = Pages::Huge;
+	}
+	if (m_mapping == nullptr) {
+		m_mapping = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		m_pages = Pages::Normal;
+	}
+	m_base = static_cast<char*>(m_mapping);
+	m_mappedBytes = bytes;
+#else
+	//pages reserved through hugetlbfs, failing when none are configured
+	void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (mapping != MAP_FAILED) {
+		m_mapping = mapping;
+		m_base = static_cast<char*>(mapping);
+		m_mappedBytes = bytes;
+		m_pages = Pages::Huge;
+		return true;
+	}
+	//otherwise normal pages, aligned so the kernel can merge them into transparent huge pages
+	m_mappedBytes = bytes + s_hugePageSize;
+	mapping = mmap(nullptr, m_mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) {
+		m_mappedBytes = 0;
+		return false;
+	}
+	m_mapping = mapping;
+	const uintptr_t address = reinterpret_cast<uintptr_t>(mapping);
+	m_base = reinterpret_cast<char*>((address + s_hugePageSize - 1) / s_hugePageSize * s_hugePageSize);
+	m_pages = (madvise(m_base, bytes, MADV_HUGEPAGE) == 0 && transparentHugePages()) ? Pages::Transparent :
+		Pages::Normal;
+#endif
+	return m_mapping != nullptr;
+}
+
+void* ParticleArena::take(const size_t bytes)
+{
+	if (bytes > m_slotBytes) {
+		return nullptr;
+	}
+	lock_guard<mutex> lock(m_mutex);
+	for (size_t i = 0; i < m_used.size(); i++) {
+		if (!m_used[i]) {
+			m_used[i] = true;
+			return m_base + i * m_slotBytes;
+		}
+	}
+	return nullptr;
+}
+
+bool ParticleArena::give(void* memory)
+{
+	char* slot = static_cast<char*>(memory);
+	if (m_used.empty() || slot < m_base || slot >= m_base + m_slotBytes * m_used.size()) {
+		return false;
+	}
+	lock_guard<mutex> lock(m_mutex);
+	m_used[(slot - m_base) / m_slotBytes] = false;
+	return true;
+}
+
+char* ParticleArena::getSlot(const uint32_t slot) const
+{
+	return m_base + slot * m_slotBytes;
+}
+
+uint32_t ParticleArena::getSlots() const
+{
+	return static_cast<uint32_t>(m_used.size());
+}
+
+size_t ParticleArena::getSlotBytes() const
+{
+	return m_slotBytes;
+}
+
+ParticleArena::Pages ParticleArena::getPages() const
+{
+	return m_pages;
+}
+
+size_t ParticleArena::getPageSize() const
+{
+	return (m_pages == Pages::Normal) ? 4096 : s_hugePageSize;
+}
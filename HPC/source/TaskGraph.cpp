@@ -0,0 +1,164 @@
+#include <fstream>
+#include "TaskGraph.h"
+
+using namespace std;
+
+TaskGraph::TaskGraph(ThreadPool& pool)
+	: m_pool(pool)
+{
+}
+
+TaskGraph::~TaskGraph()
+{
+	wait();
+}
+
+uint32_t TaskGraph::addStage(const string& name, function<void()> work, const bool waitForFrame,
+	const ThreadPool::Priority priority)
+{
+	Stage stage;
+	stage.m_name = name;
+	stage.m_work = move(work);
+	stage.m_waitForFrame = waitForFrame;
+	stage.m_priority = priority;
+	m_stages.push_back(move(stage));
+	const uint32_t index = static_cast<uint32_t>(m_stages.size() - 1);
+	//a stage never overlaps its own previous frame
+	addFrameDependency(index, index);
+	return index;
+}
+
+void TaskGraph::addDependency(const uint32_t before, const uint32_t after)
+{
+	m_stages[before].m_next.push_back(after);
+	m_stages[after].m_dependencies++;
+}
+
+void TaskGraph::addFrameDependency(const uint32_t before, const uint32_t after)
+{
+	m_stages[before].m_nextFrame.push_back(after);
+	m_stages[after].m_previousFrame.push_back(before);
+}
+
+void TaskGraph::run()
+{
+	//the ready list lives in the caller's scratch arena so a frame allocates nothing
+	FrameArena::Scope scope(m_pool.scratch());
+	ArenaVector<uint32_t> ready{ ArenaAllocator<uint32_t>(m_pool.scratch()) };
+	ready.reserve(m_stages.size());
+	uint64_t frame;
+	{
+		unique_lock<mutex> lock(m_mutex);
+		frame = ++m_frame;
+		const uint32_t slot = frame & 1;
+		//the slot was last used two frames ago, which the previous run() waited for
+		m_frameStart[slot] = clock_type::now();
+		m_remaining[slot] = static_cast<uint32_t>(m_stages.size());
+		m_waitRemaining[slot] = 0;
+		for (uint32_t i = 0; i < m_stages.size(); i++) {
+			Stage& stage = m_stages[i];
+			m_waitRemaining[slot] += stage.m_waitForFrame ? 1 : 0;
+			//only count previous frame stages still running, the rest have already passed
+			uint32_t pending = stage.m_dependencies;
+			for (uint32_t previous : stage.m_previousFrame) {
+				pending += (m_stages[previous].m_completed + 1 < frame) ? 1 : 0;
+			}
+			stage.m_pending[slot] = pending;
+			if (pending == 0) {
+				ready.push_back(i);
+			}
+		}
+	}
+	for (uint32_t stage : ready) {
+		launch(stage, frame);
+	}
+
+	//wait for this frame's waited for stages and everything left from the previous frame
+	unique_lock<mutex> lock(m_mutex);
+	m_done.wait(lock, [this, frame] {
+		return m_waitRemaining[frame & 1] == 0 && (frame == 1 || m_remaining[(frame - 1) & 1] == 0);
+	});
+}
+
+void TaskGraph::wait()
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_done.wait(lock, [this] {
+		return m_remaining[0] == 0 && m_remaining[1] == 0;
+	});
+}
+
+void TaskGraph::launch(const uint32_t stage, const uint64_t frame)
+{
+	m_pool.enqueueFunc([this, stage, frame]() {
+		const clock_type::time_point frameStart = m_frameStart[frame & 1];
+		const clock_type::time_point start = clock_type::now();
+		m_stages[stage].m_work();
+		const clock_type::time_point end = clock_type::now();
+
+		FrameArena::Scope scope(m_pool.scratch());
+		ArenaVector<pair<uint32_t, uint64_t>> ready{ ArenaAllocator<pair<uint32_t, uint64_t>>(m_pool.scratch()) };
+		ready.reserve(m_stages.size());
+		complete(stage, frame, chrono::duration<double, milli>(start - frameStart).count(),
+			chrono::duration<double, milli>(end - frameStart).count(), ready);
+		for (const auto& next : ready) {
+			launch(next.first, next.second);
+		}
+	}, m_stages[stage].m_priority);
+}
+
+void TaskGraph::complete(const uint32_t index, const uint64_t frame, const double start, const double end,
+	ArenaVector<pair<uint32_t, uint64_t>>& ready)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Stage& stage = m_stages[index];
+	stage.m_completed = frame;
+	stage.m_frames++;
+	stage.m_total += end - start;
+	stage.m_start = start;
+	stage.m_end = end;
+	const uint32_t slot = frame & 1;
+	for (uint32_t next : stage.m_next) {
+		if (--m_stages[next].m_pending[slot] == 0) {
+			ready.emplace_back(next, frame);
+		}
+	}
+	//the next frame only counted this stage if it had already started
+	if (m_frame > frame) {
+		for (uint32_t next : stage.m_nextFrame) {
+			if (--m_stages[next].m_pending[slot ^ 1] == 0) {
+				ready.emplace_back(next, frame + 1);
+			}
+		}
+	}
+	m_remaining[slot]--;
+	m_waitRemaining[slot] -= stage.m_waitForFrame ? 1 : 0;
+	if (m_remaining[slot] == 0 || m_waitRemaining[slot] == 0) {
+		m_done.notify_all();
+	}
+}
+
+vector<TaskGraph::Timing> TaskGraph::timings() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	vector<Timing> timings;
+	for (const auto& stage : m_stages) {
+		timings.push_back(Timing{ stage.m_name, stage.m_frames,
+			(stage.m_frames > 0) ? stage.m_total / stage.m_frames : 0.0, stage.m_start, stage.m_end });
+	}
+	return timings;
+}
+
+bool TaskGraph::exportTimings(const string& fileName) const
+{
+	ofstream file(fileName);
+	if (!file) {
+		return false;
+	}
+	file << "stage,frames,mean ms,last start ms,last end ms\n";
+	for (const auto& timing : timings()) {
+		file << timing.m_name << ',' << timing.m_frames << ',' << timing.m_mean << ',' << timing.m_start << ','
+			<< timing.m_end << '\n';
+	}
+	return static_cast<bool>(file);
+}
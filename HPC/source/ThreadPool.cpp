@@ -1,88 +1,520 @@
-#include <mutex>
-#include <thread>
-#include "ThreadPool.h"
-
-using namespace std;
-
-ThreadPool::ThreadPool()
-{
-	const uint32_t numThreads = max(thread::hardware_concurrency(), 1U);
-	for (uint32_t i = 0; i < numThreads; ++i) {
-		m_threads.emplace_back(&ThreadPool::threadFunc, this);
-	}
-}
-
-ThreadPool::~ThreadPool()
-{
-	shutdown();
-	for (auto& worker : m_threads) {
-		worker.join();
-	}
-}
-
-size_t ThreadPool::size() const
-{
-	return m_threads.size();;
-}
-
-void ThreadPool::shutdown()
-{
-	lock_guard<mutex> lock(m_mutex);
-	m_shutdown = true;
-	m_conditionVar.notify_all();
-}
-
-void ThreadPool::threadFunc()
-{
-	while (true) {
-		function<void()> task;
-		{
-			//Try and get the queue lock. Wait on the condition variable 
-			// if the lock could not be immediately acquired
-			unique_lock<mutex> lock(m_mutex);
-			m_conditionVar.wait(lock, [this] {
-				return m_shutdown || !m_queue.empty();
-			});
-			//Check that the pool has not been shut down and exit if it has
-			if (m_shutdown) {
-				return;
-			}
-			//Move the queued task from the queue
-			task = move(m_queue.front());
-			m_queue.pop();
-		}
-		//Execute the new task
-		task();
-	}
-}
-
-
-
-
-void ThreadPool::enqueueFunc(function<void()> func)
-{
-	lock_guard<mutex> lock(m_mutex);
-	if (m_shutdown.load()) {
-		throw runtime_error("enqueue on stopped ThreadPool");
-	}
-	m_queue.push(move(func));
-	m_conditionVar.notify_one();
-}
-
-future<int> ThreadPool::enqueueFunc(function<int(int)> func, int arg)
-{
-	//Create a packaged task by binding the input task together with 
-	//its input argument
-	auto task = make_shared<packaged_task<int()>>(bind(func, arg));
-	//Get the packaged_task's future
-	future<int> ret = task->get_future();
-	//Convert the packaged task to a void() function that can be passed
-	// to the original enqueueFunc
-	enqueueFunc([task]() {
-		(*task)();
-	});
-	return ret;
-}
-
-
-
+#include <algorithm>
+#include <immintrin.h>
+#include <mutex>
+#include <thread>
+#include "AllocationCounter.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+/** The pool the current thread is a worker of (if any) */
+static thread_local ThreadPool* t_pool = nullptr;
+/** The index of the current worker within its pool */
+static thread_local uint32_t t_index = 0;
+/** The pool whose parallel_for the current thread started and is still running (if any) */
+static thread_local ThreadPool* t_parallelPool = nullptr;
+/** Whether the current worker is running a background task */
+static thread_local bool t_background = false;
+
+/**
+* Waits a short time while spinning on a condition.
+* @param spin The number of times the condition has been checked.
+*/
+static void spinWait(uint32_t spin)
+{
+	if (spin < ThreadPool::s_spinCount) {
+		_mm_pause();
+	} else {
+		this_thread::yield();
+	}
+}
+
+ThreadPool::ThreadPool()
+	: ThreadPool(Config())
+{
+}
+
+ThreadPool::ThreadPool(const Config& config)
+{
+	//Work out which cpus the workers run on, the caller keeps the first core to itself if reserved
+	const CpuTopology topology = CpuTopology::detect();
+	const uint32_t reservedCore = config.m_reserveCaller ? topology.cpus().front().m_core : UINT32_MAX;
+	vector<CpuTopology::Cpu> cpus = topology.order(config.m_affinity, reservedCore);
+	//without a placement policy the workers are still kept off the reserved core, the OS places
+	// them among the rest
+	vector<uint32_t> unreserved;
+	if (config.m_reserveCaller) {
+		CpuTopology::pinCurrentThread(topology.cpus().front().m_id);
+		for (const auto& cpu : topology.cpus()) {
+			if (cpu.m_core != reservedCore && config.m_affinity == Affinity::None) {
+				unreserved.push_back(cpu.m_id);
+			}
+		}
+	}
+	uint32_t numThreads = config.m_threads;
+	if (numThreads == 0) {
+		numThreads = (config.m_affinity != Affinity::None) ? static_cast<uint32_t>(cpus.size()) :
+			!unreserved.empty() ? static_cast<uint32_t>(unreserved.size()) : max(thread::hardware_concurrency(), 1U);
+		numThreads = max(numThreads, 1U);
+	}
+	m_backgroundLimit = (config.m_backgroundThreads != 0) ? min(config.m_backgroundThreads, numThreads) :
+		max(numThreads / 2, 1U);
+	for (uint32_t i = 0; i < numThreads; ++i) {
+		m_deques.emplace_back(make_unique<Deque>());
+	}
+	m_clocks = make_unique<ThreadClock[]>(numThreads + 1);
+	m_owned = make_unique<OwnedCursor[]>(ownerCount());
+	m_scratch = make_unique<FrameArena[]>(numThreads + 1);
+	for (const auto& cpu : topology.cpus()) {
+		m_cpuPackages.resize(max<size_t>(m_cpuPackages.size(), cpu.m_id + 1), 0);
+		m_cpuPackages[cpu.m_id] = cpu.m_package;
+	}
+	m_clockStart = clock_type::now();
+	for (uint32_t i = 0; i < numThreads; ++i) {
+		m_threads.emplace_back(&ThreadPool::threadFunc, this, i);
+		//Workers beyond the number of cpus wrap around
+		if (!cpus.empty()) {
+			CpuTopology::pin(m_threads.back().native_handle(), cpus[i % cpus.size()].m_id);
+		} else if (!unreserved.empty()) {
+			CpuTopology::pin(m_threads.back().native_handle(), unreserved);
+		}
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	shutdown();
+	for (auto& worker : m_threads) {
+		worker.join();
+	}
+	//Release any tasks that were never run
+	while (Task* task = m_queue.pop()) {
+		delete task;
+	}
+	while (Task* task = m_backgroundQueue.pop()) {
+		delete task;
+	}
+	for (auto& deque : m_deques) {
+		while (Task* task = deque->pop()) {
+			delete task;
+		}
+	}
+	while (Task* task = m_freeTasks.pop()) {
+		delete task;
+	}
+}
+
+size_t ThreadPool::size() const
+{
+	return m_threads.size();;
+}
+
+uint32_t ThreadPool::ownerCount() const
+{
+	return static_cast<uint32_t>(max<size_t>(m_threads.size(), 1));
+}
+
+uint32_t ThreadPool::currentThread() const
+{
+	return (t_pool == this) ? t_index : static_cast<uint32_t>(m_threads.size());
+}
+
+uint32_t ThreadPool::currentPackage() const
+{
+	const uint32_t cpu = CpuTopology::currentCpu();
+	return (cpu < m_cpuPackages.size()) ? m_cpuPackages[cpu] : 0;
+}
+
+uint32_t ThreadPool::packageCount() const
+{
+	return m_cpuPackages.empty() ? 1 : *max_element(m_cpuPackages.begin(), m_cpuPackages.end()) + 1;
+}
+
+FrameArena& ThreadPool::scratch()
+{
+	return m_scratch[currentThread()];
+}
+
+vector<ThreadPool::ThreadTime> ThreadPool::takeThreadTimes()
+{
+	const auto now = clock_type::now();
+	const double elapsed = chrono::duration<double, milli>(now - m_clockStart).count();
+	m_clockStart = now;
+	vector<ThreadTime> times(m_threads.size() + 1);
+	for (size_t i = 0; i < times.size(); ++i) {
+		times[i].m_busy = m_clocks[i].m_busy.exchange(0) * 1e-6;
+		times[i].m_idle = m_clocks[i].m_idle.exchange(0) * 1e-6;
+		//workers are always running so any time not spent working was spent idle
+		if (i < m_threads.size()) {
+			times[i].m_idle = max(elapsed - times[i].m_busy, 0.0);
+		}
+	}
+	return times;
+}
+
+void ThreadPool::shutdown()
+{
+	m_shutdown = true;
+	m_wake.notifyAll();
+}
+
+Task* ThreadPool::findTask(uint32_t index)
+{
+	//Newest local work first as it is most likely still in cache
+	Task* task = m_deques[index]->pop();
+	if (task == nullptr && m_pending.load(memory_order_relaxed) > 0) {
+		task = m_queue.pop();
+		//Steal the oldest work from the other workers starting at a random victim
+		if (task == nullptr) {
+			static thread_local uint32_t seed = index * 2654435761U + 1U;
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			const uint32_t numDeques = static_cast<uint32_t>(m_deques.size());
+			for (uint32_t i = 0; i < numDeques && task == nullptr; ++i) {
+				const uint32_t victim = (seed + i) % numDeques;
+				if (victim != index) {
+					task = m_deques[victim]->steal();
+				}
+			}
+		}
+	}
+	if (task != nullptr) {
+		m_pending.fetch_sub(1);
+	}
+	return task;
+}
+
+Task* ThreadPool::findBackgroundTask()
+{
+	if (m_backgroundPending.load(memory_order_relaxed) <= 0) {
+		return nullptr;
+	}
+	//Claim a background slot before taking a task so the limit is never exceeded
+	uint32_t running = m_backgroundRunning.load(memory_order_relaxed);
+	do {
+		if (running >= m_backgroundLimit) {
+			return nullptr;
+		}
+	} while (!m_backgroundRunning.compare_exchange_weak(running, running + 1));
+	Task* task = m_backgroundQueue.pop();
+	if (task == nullptr) {
+		m_backgroundRunning.fetch_sub(1);
+		return nullptr;
+	}
+	m_backgroundPending.fetch_sub(1);
+	return task;
+}
+
+bool ThreadPool::backgroundReady() const
+{
+	return m_backgroundPending.load() > 0 && m_backgroundRunning.load() < m_backgroundLimit;
+}
+
+bool ThreadPool::parallelReady(uint32_t seen) const
+{
+	const uint32_t epoch = m_epoch.load();
+	return (epoch & 1) != 0 && epoch != seen;
+}
+
+bool ThreadPool::joinParallel(uint32_t index, uint32_t& seen)
+{
+	const uint32_t epoch = m_epoch.load();
+	if ((epoch & 1) == 0 || epoch == seen) {
+		return false;
+	}
+	seen = epoch;
+	//Register before rechecking the epoch so the caller either waits for this worker or
+	// this worker sees that the parallel_for has already finished
+	m_joined.fetch_add(1);
+	if (m_epoch.load() == epoch) {
+		const auto start = clock_type::now();
+		workParallel(index);
+		m_clocks[index].m_busy.fetch_add((clock_type::now() - start).count(), memory_order_relaxed);
+	}
+	m_joined.fetch_sub(1);
+	return true;
+}
+
+bool ThreadPool::claimOwned(uint32_t owner, uint32_t& start, uint32_t& last)
+{
+	//the owner's claims are every ownerCount()th claim of the grid from item 0, starting at its
+	// index, so a range that does not start at 0 keeps the owners of its items
+	const uint64_t threads = ownerCount();
+	const uint64_t firstClaim = m_rangeBegin / m_rangeGrain;
+	const uint64_t claim = firstClaim + (owner + threads - firstClaim % threads) % threads +
+		threads * m_owned[owner].m_next.fetch_add(1, memory_order_relaxed);
+	const uint64_t first = claim * m_rangeGrain;
+	if (first >= m_rangeEnd) {
+		return false;
+	}
+	start = static_cast<uint32_t>(max<uint64_t>(first, m_rangeBegin));
+	last = static_cast<uint32_t>(min<uint64_t>(first + m_rangeGrain, m_rangeEnd));
+	return true;
+}
+
+void ThreadPool::workParallel(uint32_t index)
+{
+	if (m_rangeSchedule == Schedule::Owned) {
+		//own claims first then help the other threads, starting with the next one. A caller that owns
+		// none gives the workers a moment to join and take theirs before it helps
+		const uint32_t owners = ownerCount();
+		for (uint32_t spin = 0; index >= owners && spin < s_spinCount && m_joined.load() < owners; ++spin) {
+			spinWait(spin);
+		}
+		for (uint32_t i = 0; i < owners; ++i) {
+			const uint32_t owner = (index + i) % owners;
+			uint32_t start;
+			uint32_t last;
+			while (claimOwned(owner, start, last)) {
+				m_rangeFunc(m_rangeContext, start, last);
+				m_rangeDone.fetch_add(last - start, memory_order_release);
+			}
+		}
+		return;
+	}
+	const uint32_t end = m_rangeEnd;
+	const uint32_t grain = m_rangeGrain;
+	const uint32_t share = m_rangeShare;
+	const bool guided = m_rangeSchedule == Schedule::Guided;
+	uint32_t start = m_rangeNext.load(memory_order_relaxed);
+	while (true) {
+		uint32_t last;
+		if (guided) {
+			//Take a share of what is left so claims shrink as the range runs out
+			do {
+				if (start >= end) {
+					return;
+				}
+				const uint32_t count = max((end - start) / share, grain);
+				last = (end - start > count) ? start + count : end;
+			} while (!m_rangeNext.compare_exchange_weak(start, last, memory_order_relaxed));
+		} else {
+			start = m_rangeNext.fetch_add(grain, memory_order_relaxed);
+			if (start >= end) {
+				return;
+			}
+			last = (end - start > grain) ? start + grain : end;
+		}
+		m_rangeFunc(m_rangeContext, start, last);
+		m_rangeDone.fetch_add(last - start, memory_order_release);
+		start = last;
+	}
+}
+
+void ThreadPool::parallelFor(uint32_t begin, uint32_t end, uint32_t grain, RangeFunc func, void* context,
+	Schedule schedule)
+{
+	if (begin >= end) {
+		return;
+	}
+	grain = max(grain, 1U);
+	//A nested call from the thread already holding the mutex must not try to lock it again
+	if (t_parallelPool == this || end - begin <= grain) {
+		func(context, begin, end);
+		return;
+	}
+	unique_lock<mutex> lock(m_parallelMutex, try_to_lock);
+	//Workers may also start one, the other workers then join it as they would for any caller
+	if (!lock.owns_lock()) {
+		func(context, begin, end);
+		return;
+	}
+	ThreadPool* const outerPool = t_parallelPool;
+	t_parallelPool = this;
+	m_rangeFunc = func;
+	m_rangeContext = context;
+	m_rangeEnd = end;
+	m_rangeGrain = grain;
+	m_rangeSchedule = schedule;
+	m_rangeShare = static_cast<uint32_t>(m_threads.size() + 1) * 2;
+	m_rangeBegin = begin;
+	m_rangeNext.store(begin, memory_order_relaxed);
+	m_rangeDone.store(0, memory_order_relaxed);
+	for (uint32_t i = 0; i < ownerCount() && schedule == Schedule::Owned; ++i) {
+		m_owned[i].m_next.store(0, memory_order_relaxed);
+	}
+	//Publish the range to the workers, only waking them if some are asleep and only as many as
+	// there are ranges for besides the caller's. Owned ranges need their owners so wake them all
+	m_epoch.fetch_add(1);
+	const uint32_t helpers = (end - begin + grain - 1) / grain - 1;
+	if (helpers >= m_threads.size() || schedule == Schedule::Owned) {
+		m_wake.notifyAll();
+	} else {
+		for (uint32_t i = 0; i < helpers; i++) {
+			m_wake.notifyOne();
+		}
+	}
+	ThreadClock& clock = m_clocks[m_threads.size()];
+	const auto start = clock_type::now();
+	workParallel(currentThread());
+	const auto finish = clock_type::now();
+	clock.m_busy.fetch_add((finish - start).count(), memory_order_relaxed);
+	const uint32_t count = end - begin;
+	for (uint32_t spin = 0; m_rangeDone.load(memory_order_acquire) != count; ++spin) {
+		spinWait(spin);
+	}
+	//Close the range then wait for any worker still inside it before it can be reused
+	m_epoch.fetch_add(1);
+	for (uint32_t spin = 0; m_joined.load() != 0; ++spin) {
+		spinWait(spin);
+	}
+	clock.m_idle.fetch_add((clock_type::now() - finish).count(), memory_order_relaxed);
+	t_parallelPool = outerPool;
+}
+
+void ThreadPool::threadFunc(uint32_t index)
+{
+	t_pool = this;
+	t_index = index;
+	AllocationCounter::trackThread();
+	uint32_t seen = 0;
+	while (true) {
+		Task* task = findTask(index);
+		if (task == nullptr) {
+			if (joinParallel(index, seen)) {
+				continue;
+			}
+			//Background work only runs when there is no frame work, one task at a time so
+			// frame work queued meanwhile is taken before the next one
+			task = findBackgroundTask();
+			if (task != nullptr) {
+				runBackgroundTask(index, task);
+				continue;
+			}
+			//Spin briefly so back to back work finds the worker awake
+			uint32_t spin = 0;
+			while (spin < s_spinCount && m_pending.load(memory_order_relaxed) <= 0 && !parallelReady(seen)
+				&& !backgroundReady() && !m_shutdown.load(memory_order_relaxed)) {
+				_mm_pause();
+				++spin;
+			}
+			if (spin < s_spinCount && !m_shutdown.load()) {
+				continue;
+			}
+			//Sleep until new work is added. The worker registers as a waiter before the
+			// pending count is rechecked so a submitter either sees it waiting or it sees
+			// the new task (no lost wakeups)
+			const uint32_t key = m_wake.prepareWait();
+			if (m_shutdown.load() || m_pending.load() > 0 || parallelReady(seen) || backgroundReady()) {
+				m_wake.cancelWait();
+			} else {
+				m_wake.wait(key);
+			}
+			//Check that the pool has not been shut down and exit if it has
+			if (m_shutdown) {
+				return;
+			}
+			continue;
+		}
+		runTask(index, task);
+	}
+}
+
+void ThreadPool::runTask(uint32_t index, Task* task)
+{
+	const auto start = clock_type::now();
+	(*task)();
+	freeTask(task);
+	m_clocks[index].m_busy.fetch_add((clock_type::now() - start).count(), memory_order_relaxed);
+}
+
+void ThreadPool::runBackgroundTask(uint32_t index, Task* task)
+{
+	const bool background = t_background;
+	t_background = true;
+	runTask(index, task);
+	t_background = background;
+	m_backgroundRunning.fetch_sub(1);
+	//A worker sleeping because the limit was reached can now take the next one
+	if (m_backgroundPending.load() > 0) {
+		m_wake.notifyOne();
+	}
+}
+
+void ThreadPool::wait(Latch& latch)
+{
+	if (t_pool != this) {
+		latch.wait();
+		return;
+	}
+	//A waiting worker keeps running tasks, or it could be holding up the ones it waits for. Frame
+	// work never waits behind a background job, only a background task waiting for background work
+	// takes it, in the background slot it already holds
+	for (uint32_t spin = 0; !latch.tryWait(); ++spin) {
+		if (Task* task = findTask(t_index)) {
+			runTask(t_index, task);
+			spin = 0;
+		} else if (Task* background = t_background ? m_backgroundQueue.pop() : nullptr) {
+			m_backgroundPending.fetch_sub(1);
+			runTask(t_index, background);
+			spin = 0;
+		} else {
+			spinWait(spin);
+		}
+	}
+}
+
+void ThreadPool::enqueueFunc(Task func, Priority priority)
+{
+	if (m_shutdown.load()) {
+		throw runtime_error("enqueue on stopped ThreadPool");
+	}
+	Task* task = makeTask(move(func));
+	if (priority == Priority::Background) {
+		while (!m_backgroundQueue.push(task)) {
+			this_thread::yield();
+		}
+		m_backgroundPending.fetch_add(1);
+		m_wake.notifyOne();
+		return;
+	}
+	if (t_pool == this) {
+		//Work submitted from inside a task stays local to the submitting worker
+		m_deques[t_index]->push(task);
+	} else {
+		//The queue is bounded, wait for the workers to make room if it is full
+		while (!m_queue.push(task)) {
+			this_thread::yield();
+		}
+	}
+	m_pending.fetch_add(1);
+	m_wake.notifyOne();
+}
+
+Task* ThreadPool::makeTask(Task&& func)
+{
+	Task* task = m_freeTasks.pop();
+	if (task == nullptr) {
+		return new Task(move(func));
+	}
+	*task = move(func);
+	return task;
+}
+
+void ThreadPool::freeTask(Task* task)
+{
+	//the callable and its captures are released now rather than when the task is reused
+	*task = Task();
+	if (!m_freeTasks.push(task)) {
+		delete task;
+	}
+}
+
+future<int> ThreadPool::enqueueFunc(function<int(int)> func, int arg)
+{
+	//Create a packaged task that calls the input task with its input argument
+	packaged_task<int()> task([func = move(func), arg]() {
+		return func(arg);
+	});
+	//Get the packaged_task's future
+	future<int> ret = task.get_future();
+	//Tasks are move only so the packaged task is moved in rather than shared
+	enqueueFunc([task = move(task)]() mutable {
+		task();
+	});
+	return ret;
+}
+
+
+
@@ -1,4 +1,7 @@
 #include "HPCEngine.h"
+#ifdef HPC_BENCHMARK
+#    include "Benchmark.h"
+#endif
 #ifdef _WIN32
 #    define WIN32_LEAN_AND_MEAN
 #    include <Windows.h>
@@ -8,6 +11,11 @@ INT WINAPI WinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPSTR, _In_ int)
 int main(int argc, char** argv)
 #endif
 {
+#ifdef HPC_BENCHMARK
+    // Run the headless benchmarks instead of the engine
+    return Benchmark::run() ? 0 : 1;
+#else
     // Run the engine
     return HPCEngine::run() ? 0 : 1;
+#endif
 }
\ No newline at end of file